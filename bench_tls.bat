@@ -0,0 +1,35 @@
+@echo off
+rem Throughput of sender/listener with and without TLS, same file and machine.
+rem Usage: bench_tls.bat [file] [runs] [cache_mb]
+rem Run from the folder holding sender.exe and listener.exe; [file] is served from there.
+rem cache_mb 0 (the default) reads the file from disk every run; a larger budget times the cached path.
+rem Sender output goes to bench_sender_plain.log and bench_sender_tls.log.
+setlocal
+set FILE=%~1
+if "%FILE%"=="" set FILE=data.txt
+set RUNS=%~2
+if "%RUNS%"=="" set RUNS=3
+set CACHE=%~3
+if "%CACHE%"=="" set CACHE=0
+
+echo === plaintext ===
+start "" /b cmd /c "sender.exe 5050 %CACHE% . > bench_sender_plain.log 2>&1"
+timeout /t 2 /nobreak > nul
+for /l %%i in (1,1,%RUNS%) do listener.exe 127.0.0.1 receive %FILE% | findstr /c:"MB/s"
+taskkill /im sender.exe /f > nul 2>&1
+timeout /t 1 /nobreak > nul
+
+echo === TLS ===
+start "" /b cmd /c "set TRANSFER_TLS=1&& sender.exe 5050 %CACHE% . > bench_sender_tls.log 2>&1"
+timeout /t 5 /nobreak > nul
+set PIN=
+for /f "tokens=2 delims==" %%p in ('findstr /c:"TRANSFER_TLS_PIN=" bench_sender_tls.log') do set PIN=%%p
+if "%PIN%"=="" (
+    echo Sender did not start with TLS; see bench_sender_tls.log
+    goto :done
+)
+for /l %%i in (1,1,%RUNS%) do cmd /c "set TRANSFER_TLS_PIN=%PIN%&& listener.exe 127.0.0.1 receive %FILE%" | findstr /c:"MB/s"
+
+:done
+taskkill /im sender.exe /f > nul 2>&1
+endlocal
@@ -0,0 +1,41 @@
+@echo off
+rem Throughput of sender/listener through wanproxy at several emulated round-trip times,
+rem with connection tuning on and off (TRANSFER_TUNE=0) at each one.
+rem Usage: bench_wan.bat [file] [bandwidth_kbps]
+rem Run from the folder holding sender.exe, listener.exe and wanproxy.exe; [file] is served from there.
+rem
+rem What this can and can't show: wanproxy is a split-TCP relay, so both endpoints' kernels see
+rem loopback RTT through it, and in-flight data is capped by the proxy's own 4 MB window per
+rem direction rather than by the endpoints' socket buffers. The tuner still learns the emulated
+rem RTT from its application-level probe, so the comparison covers chunk sizing and SO_SNDBUF
+rem choices per RTT, but not how a real path's window would respond to them. For that, run sender
+rem and listener on two machines across a real WAN link. The sender's "Tuned send" decisions are
+rem in bench_sender_tuned.log. No Windows results from this script have been recorded, so the
+rem tuning gain is unmeasured.
+setlocal
+set FILE=%~1
+if "%FILE%"=="" set FILE=data.txt
+set BW=%~2
+if "%BW%"=="" set BW=0
+
+start "" /b cmd /c "sender.exe 6050 0 . > bench_sender_tuned.log 2>&1"
+start "" /b cmd /c "set TRANSFER_TUNE=0&& sender.exe 6060 0 . > bench_sender_untuned.log 2>&1"
+timeout /t 1 /nobreak > nul
+
+for %%L in (0 5 25 50 100) do (
+    call :run %%L tuned 6050 1
+    call :run %%L untuned 6060 0
+)
+
+taskkill /im sender.exe /f > nul 2>&1
+endlocal
+goto :eof
+
+rem :run <one_way_latency_ms> <label> <sender_base_port> <TRANSFER_TUNE>
+:run
+start "" /b cmd /c "wanproxy.exe 5050 127.0.0.1 %3 --latency=%1 --bandwidth=%BW% --max-connections=1 > bench_proxy_%1_%2.log 2>&1"
+timeout /t 1 /nobreak > nul
+echo === one-way latency %1 ms, bandwidth %BW% kbps, %2 ===
+cmd /c "set TRANSFER_TUNE=%4&& listener.exe 127.0.0.1 receive %FILE%" | findstr /c:"MB/s" /c:"Tuned"
+timeout /t 1 /nobreak > nul
+goto :eof
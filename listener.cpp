@@ -4,9 +4,18 @@
 #include <sstream>
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#include <mstcpip.h>
 #include <cstring>
 #include <cstdint>
+#include <climits>
 #include <cstdio>
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+
+#include "transport.h"
 
 #pragma comment(lib, "ws2_32.lib")
 
@@ -14,39 +23,295 @@
 #define PORT_RECEIVE 5050 // Port to receive files from sender
 #define PORT_SEND 5051    // Port to send files to sender
 #define CHUNK_SIZE 65536  // 64KB chunks for large files
+#define MIN_BLOCK_SIZE 4096       // Smallest integrity block accepted from sender
+#define MAX_BLOCK_SIZE 67108864   // Largest integrity block accepted from sender
+#define MAX_BAD_BLOCKS 64         // Abort mid-transfer once this many blocks fail verification
+#define MAX_REPAIR_ROUNDS 3       // Block re-request rounds before giving up
+#define REPAIR_ABORT 0xFFFFFFFFu  // Repair count telling the sender we gave up
+#define NOT_FOUND 0xFFFFFFFFu     // filename_len sent by the sender when it can't serve the request
+#define RTT_PROBE 0xFFFFFFFEu     // filename_len used to time a round trip; echoed back
+#define MAX_FILENAME_LEN 4096     // Longest filename accepted from sender
+#define MIN_CHUNK_SIZE 16384      // Adaptive chunk size bounds (CHUNK_SIZE is the starting point)
+#define MAX_CHUNK_SIZE 1048576
+#define MIN_SOCKET_BUFFER 65536   // Adaptive SO_SNDBUF bounds
+#define MAX_SOCKET_BUFFER 16777216
+#define TUNE_INTERVAL_MS 250      // How often a connection re-tunes itself
+
+// Little-endian encode/decode helpers
+void putLe32(char *buf, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        buf[i] = (v >> (i * 8)) & 0xFF;
+}
 
-// Helper: send all bytes from buf
-bool sendAllBytes(SOCKET sock, const char *buf, int len)
+void putLe64(char *buf, uint64_t v)
 {
-    int total = 0;
-    while (total < len)
+    for (int i = 0; i < 8; i++)
+        buf[i] = (v >> (i * 8)) & 0xFF;
+}
+
+uint32_t getLe32(const char *buf)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++)
+        v |= (uint32_t)(uint8_t)buf[i] << (i * 8);
+    return v;
+}
+
+uint64_t getLe64(const char *buf)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++)
+        v |= (uint64_t)(uint8_t)buf[i] << (i * 8);
+    return v;
+}
+
+// Adaptive tuning is on unless TRANSFER_TUNE=0, which keeps the fixed CHUNK_SIZE and the OS
+// socket defaults so benchmarks have an untuned baseline
+bool tuningEnabled = true;
+
+// Per-connection transport tuning. Every TUNE_INTERVAL_MS it samples delivery rate and the
+// RTT and picks an I/O chunk that carries ~10 ms of data. SO_SNDBUF is left to the stack's send
+// autotuning until a measured 2x bandwidth-delay product exceeds what the stack already buffers
+// (its ideal send backlog, or the current SO_SNDBUF); only then is it set, and kept at ~2x BDP
+// from there. The receive side only adapts its chunk: setting SO_RCVBUF on Windows turns off
+// receive window autotuning, which already does the job better.
+struct ConnectionTuner
+{
+    SOCKET sock;
+    bool sending;
+    bool enabled = tuningEnabled;
+    int chunkSize = CHUNK_SIZE;
+    int sendBuffer = 0;         // current SO_SNDBUF (sending side only)
+    bool sendBufferSet = false; // SO_SNDBUF is ours rather than the stack's default
+    double rttMs = 0;
+    double kernelRttMs = 0; // SIO_TCP_INFO estimate
+    double probeRttMs = 0;  // application-level round trip from probeRtt()
+    double rateMBs = 0;
+    long long lastBytes = 0;
+    std::chrono::steady_clock::time_point lastSample = std::chrono::steady_clock::now();
+
+    ConnectionTuner(SOCKET s, bool isSending) : sock(s), sending(isSending)
     {
-        int sent = send(sock, buf + total, len - total, 0);
-        if (sent == SOCKET_ERROR)
+        if (!enabled)
+            return;
+
+        // No Nagle: bulk data goes out in full chunks anyway, and the small control messages
+        // (file requests, repair lists) must not wait behind a delayed ACK
+        BOOL noDelay = TRUE;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&noDelay, sizeof(noDelay));
+
+        if (sending)
         {
-            std::cerr << "Send error: " << WSAGetLastError() << "\n";
+            int len = sizeof(sendBuffer);
+            getsockopt(sock, SOL_SOCKET, SO_SNDBUF, (char *)&sendBuffer, &len);
+        }
+    }
+
+    // Time one application-level round trip before the header goes out: RTT_PROBE is sent where
+    // the receiver expects a filename length, and the receiver echoes it. A proxy or WAN emulator
+    // that terminates TCP hides the path RTT from SIO_TCP_INFO, but not from this probe.
+    // Returns false if the connection failed.
+    bool probeRtt()
+    {
+        if (!enabled)
+            return true;
+        char probe[4], echo[4];
+        putLe32(probe, RTT_PROBE);
+        auto start = std::chrono::steady_clock::now();
+        if (!sendAllBytes(sock, probe, 4) || !recvExactBytes(sock, echo, 4))
+            return false;
+        if (getLe32(echo) != RTT_PROBE)
+        {
+            std::cerr << "Peer did not answer the RTT probe\n";
             return false;
         }
-        total += sent;
+        lastSample = std::chrono::steady_clock::now(); // the probe's wait isn't transfer time
+        probeRttMs = std::chrono::duration<double, std::milli>(lastSample - start).count();
+        return true;
+    }
+
+    // Report progress (total bytes moved so far); re-tunes when a sample interval has passed
+    void onProgress(long long bytesDone)
+    {
+        if (!enabled)
+            return;
+        auto now = std::chrono::steady_clock::now();
+        double elapsedMs = std::chrono::duration<double, std::milli>(now - lastSample).count();
+        if (elapsedMs < TUNE_INTERVAL_MS)
+            return;
+
+        rateMBs = (bytesDone - lastBytes) / elapsedMs * 1000.0 / (1024 * 1024);
+        lastBytes = bytesDone;
+        lastSample = now;
+        double bytesPerMs = rateMBs * 1024 * 1024 / 1000.0;
+
+        double rtt = sampleRttMs();
+        if (rtt > 0)
+            kernelRttMs = rtt;
+        // The kernel sees only the first hop when something terminates TCP on the way,
+        // so trust whichever estimate shows the longer path
+        rttMs = std::max(kernelRttMs, probeRttMs);
+
+        // Chunk: ~10 ms of data per call, power of two within [MIN_CHUNK_SIZE, MAX_CHUNK_SIZE]
+        int chunk = MIN_CHUNK_SIZE;
+        while (chunk < MAX_CHUNK_SIZE && chunk < bytesPerMs * 10)
+            chunk *= 2;
+        bool changed = chunk != chunkSize;
+        chunkSize = chunk;
+
+        // Send buffer: 2x BDP so the window never starves while we're in a syscall. Setting
+        // SO_SNDBUF turns off the stack's send autotuning, so don't until it falls short.
+        if (sending && rttMs > 0)
+        {
+            double bdp = bytesPerMs * rttMs;
+            int buffer = static_cast<int>(std::min<double>(MAX_SOCKET_BUFFER, std::max<double>(MIN_SOCKET_BUFFER, 2 * bdp)));
+            int stackBuffer = idealSendBacklog();
+            if (sendBufferSet)
+                buffer = std::max(buffer, stackBuffer);
+            else if (buffer <= std::max(sendBuffer, stackBuffer) * 5 / 4)
+                buffer = sendBuffer; // the stack already buffers enough
+            if (buffer > sendBuffer * 5 / 4 || buffer < sendBuffer * 3 / 4)
+            {
+                applySendBuffer(buffer);
+                changed = true;
+            }
+        }
+
+        if (changed)
+        {
+            std::cout << "Tuned " << (sending ? "send" : "receive") << ": rtt " << rttMs << " ms (kernel "
+                      << kernelRttMs << ", probe " << probeRttMs << "), rate " << rateMBs << " MB/s, chunk "
+                      << chunkSize << " bytes";
+            if (sending)
+                std::cout << ", SO_SNDBUF " << sendBuffer << " bytes";
+            std::cout << "\n";
+        }
+    }
+
+private:
+    void applySendBuffer(int size)
+    {
+        if (size > 0 && setsockopt(sock, SOL_SOCKET, SO_SNDBUF, (const char *)&size, sizeof(size)) == 0)
+        {
+            sendBuffer = size;
+            sendBufferSet = true;
+        }
+    }
+
+    // Smoothed RTT from the TCP stack, or 0 if this Windows version can't report it
+    double sampleRttMs()
+    {
+#ifdef SIO_TCP_INFO
+        DWORD version = 0;
+        TCP_INFO_v0 info;
+        DWORD bytes = 0;
+        if (WSAIoctl(sock, SIO_TCP_INFO, &version, sizeof(version), &info, sizeof(info), &bytes, NULL, NULL) == 0)
+            return info.RttUs / 1000.0;
+#endif
+        return 0;
+    }
+
+    // Bytes the stack wants queued to keep the pipe full (its own BDP estimate)
+    int idealSendBacklog()
+    {
+#ifdef SIO_IDEAL_SEND_BACKLOG_QUERY
+        ULONG isb = 0;
+        DWORD bytes = 0;
+        if (WSAIoctl(sock, SIO_IDEAL_SEND_BACKLOG_QUERY, NULL, 0, &isb, sizeof(isb), &bytes, NULL, NULL) == 0)
+            return static_cast<int>(std::min<ULONG>(isb, MAX_SOCKET_BUFFER));
+#endif
+        return 0;
+    }
+};
+
+// Read the 4-byte length that starts a transfer header, echoing any RTT probes sent ahead of it
+bool recvHeaderLength(SOCKET sock, char *lenBuf)
+{
+    while (true)
+    {
+        if (!recvExactBytes(sock, lenBuf, 4))
+            return false;
+        if (getLe32(lenBuf) != RTT_PROBE)
+            return true;
+        if (!sendAllBytes(sock, lenBuf, 4))
+            return false;
     }
-    return true;
 }
 
-// Helper: receive exactly len bytes into buf
-bool recvExactBytes(SOCKET sock, char *buf, int len)
+// xxHash64 (block hash for the integrity tree)
+static inline uint64_t rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+uint64_t xxh64(const char *data, size_t len, uint64_t seed = 0)
 {
-    int total = 0;
-    while (total < len)
+    const uint64_t P1 = 0x9E3779B185EBCA87ULL, P2 = 0xC2B2AE3D27D4EB4FULL, P3 = 0x165667B19E3779F9ULL;
+    const uint64_t P4 = 0x85EBCA77C2B2AE63ULL, P5 = 0x27D4EB2F165667C5ULL;
+    auto read64 = [](const char *p) { uint64_t v; memcpy(&v, p, 8); return v; };
+    auto read32 = [](const char *p) { uint32_t v; memcpy(&v, p, 4); return v; };
+    auto mixRound = [&](uint64_t acc, uint64_t input) { return rotl64(acc + input * P2, 31) * P1; };
+
+    const char *p = data;
+    const char *end = data + len;
+    uint64_t h;
+    if (len >= 32)
     {
-        int recvd = recv(sock, buf + total, len - total, 0);
-        if (recvd <= 0)
+        uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+        for (; p + 32 <= end; p += 32)
         {
-            std::cerr << "Recv error or connection closed: " << WSAGetLastError() << "\n";
-            return false;
+            v1 = mixRound(v1, read64(p));
+            v2 = mixRound(v2, read64(p + 8));
+            v3 = mixRound(v3, read64(p + 16));
+            v4 = mixRound(v4, read64(p + 24));
         }
-        total += recvd;
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        for (uint64_t v : {v1, v2, v3, v4})
+            h = (h ^ mixRound(0, v)) * P1 + P4;
     }
-    return true;
+    else
+        h = seed + P5;
+
+    h += (uint64_t)len;
+    for (; p + 8 <= end; p += 8)
+        h = rotl64(h ^ mixRound(0, read64(p)), 27) * P1 + P4;
+    if (p + 4 <= end)
+    {
+        h = rotl64(h ^ ((uint64_t)read32(p) * P1), 23) * P2 + P3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+        h = rotl64(h ^ ((uint64_t)(uint8_t)*p * P5), 11) * P1;
+
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+// Fold block hashes pairwise up to a single root (odd node is carried up)
+uint64_t merkleRoot(std::vector<uint64_t> level)
+{
+    if (level.empty())
+        return xxh64(nullptr, 0);
+    while (level.size() > 1)
+    {
+        std::vector<uint64_t> next;
+        for (size_t i = 0; i < level.size(); i += 2)
+        {
+            if (i + 1 == level.size())
+            {
+                next.push_back(level[i]);
+                break;
+            }
+            char pair[16];
+            putLe64(pair, level[i]);
+            putLe64(pair + 8, level[i + 1]);
+            next.push_back(xxh64(pair, 16));
+        }
+        level.swap(next);
+    }
+    return level[0];
 }
 
 // Send file using length-prefixed protocol
@@ -66,6 +331,11 @@ bool sendFile(SOCKET sock, const std::string &filename, const std::string &filep
     infile.seekg(0, std::ios::beg);
 
     std::cout << "Sending file: " << filename << " (" << fileSize << " bytes)\n";
+    auto transferStart = std::chrono::steady_clock::now();
+
+    ConnectionTuner tuner(sock, true);
+    if (!tuner.probeRtt())
+        return false;
 
     // Send filename length (4 bytes, little-endian)
     int fnLen = static_cast<int>(filename.size());
@@ -88,33 +358,60 @@ bool sendFile(SOCKET sock, const std::string &filename, const std::string &filep
     if (!sendAllBytes(sock, sizeBuf, 8))
         return false;
 
-    // Send file data in chunks
-    char chunk[CHUNK_SIZE];
+    // Send file data in chunks sized by the connection tuner
+    std::vector<char> chunk(MAX_CHUNK_SIZE);
     long long sent = 0;
     while (sent < fileSize)
     {
-        int toRead = (fileSize - sent > CHUNK_SIZE) ? CHUNK_SIZE : static_cast<int>(fileSize - sent);
-        infile.read(chunk, toRead);
-        if (!sendAllBytes(sock, chunk, toRead))
+        int toRead = (fileSize - sent > tuner.chunkSize) ? tuner.chunkSize : static_cast<int>(fileSize - sent);
+        infile.read(chunk.data(), toRead);
+        if (!sendAllBytes(sock, chunk.data(), toRead))
             return false;
         sent += toRead;
+        tuner.onProgress(sent);
     }
 
     infile.close();
+    logThroughput("Sent " + filename, fileSize, transferStart);
     std::cout << "File sent successfully.\n";
     return true;
 }
 
+// Ask the sender for a file from its catalog
+// Request format: [4-byte request_len][request] (empty = sender's default, "#<id>" = catalog ID)
+bool sendFileRequest(SOCKET sock, const std::string &request)
+{
+    char lenBuf[4];
+    putLe32(lenBuf, static_cast<uint32_t>(request.size()));
+    if (!sendAllBytes(sock, lenBuf, 4))
+        return false;
+    return request.empty() || sendAllBytes(sock, request.c_str(), static_cast<int>(request.size()));
+}
+
 // Receive file using length-prefixed protocol
-// Format: [4-byte filename_len][filename][8-byte file_size][file_data]
+// Format: [4-byte filename_len][filename][8-byte file_size][4-byte crc32]
+//         [4-byte block_size][4-byte block_count][block_count x 8-byte block hash][8-byte root hash]
+//         [file_data]
+// Each block is verified as it arrives; failed blocks are re-requested afterwards with
+// [4-byte bad_count][bad_count x 4-byte block index] (0 = done, REPAIR_ABORT = give up).
 bool receiveFile(SOCKET sock)
 {
     // Receive filename length
     char lenBuf[4];
-    if (!recvExactBytes(sock, lenBuf, 4))
+    if (!recvHeaderLength(sock, lenBuf))
+        return false;
+    if (getLe32(lenBuf) == NOT_FOUND)
+    {
+        std::cerr << "Sender does not have the requested file\n";
         return false;
+    }
     int fnLen = (lenBuf[0] & 0xFF) | ((lenBuf[1] & 0xFF) << 8) |
                 ((lenBuf[2] & 0xFF) << 16) | ((lenBuf[3] & 0xFF) << 24);
+    if (fnLen <= 0 || fnLen > MAX_FILENAME_LEN)
+    {
+        std::cerr << "Invalid filename length from sender: " << fnLen << "\n";
+        return false;
+    }
 
     // Receive filename
     std::string filename(fnLen, '\0');
@@ -136,7 +433,39 @@ bool receiveFile(SOCKET sock)
     uint32_t expectedCrc = (uint32_t)(uint8_t)crcBuf[0] | ((uint32_t)(uint8_t)crcBuf[1] << 8) |
                            ((uint32_t)(uint8_t)crcBuf[2] << 16) | ((uint32_t)(uint8_t)crcBuf[3] << 24);
 
-    std::cout << "Receiving file: " << filename << " (" << fileSize << " bytes)\n";
+    // Receive block hash tree and check the leaves against the root
+    char treeHdr[8];
+    if (!recvExactBytes(sock, treeHdr, 8))
+        return false;
+    uint32_t blockSize = getLe32(treeHdr);
+    uint32_t blockCount = getLe32(treeHdr + 4);
+    // The leaf list is read in one call, so its length (8 bytes per block + root) must fit an int.
+    // blockCount is bounded first, so blockCount * blockSize can't overflow; fileSize is never
+    // added to, so a hostile size near LLONG_MAX can't either.
+    if (blockSize < MIN_BLOCK_SIZE || blockSize > MAX_BLOCK_SIZE || fileSize < 0 ||
+        blockCount > (INT_MAX - 8) / 8 ||
+        fileSize > (long long)blockCount * blockSize ||
+        (blockCount > 0 && fileSize <= (long long)(blockCount - 1) * blockSize))
+    {
+        std::cerr << "Invalid block layout from sender (block size " << blockSize
+                  << ", count " << blockCount << ")\n";
+        return false;
+    }
+    std::vector<char> leafBuf(8 * static_cast<size_t>(blockCount) + 8);
+    if (!recvExactBytes(sock, leafBuf.data(), static_cast<int>(leafBuf.size())))
+        return false;
+    std::vector<uint64_t> blockHashes(blockCount);
+    for (uint32_t b = 0; b < blockCount; ++b)
+        blockHashes[b] = getLe64(&leafBuf[8 * b]);
+    if (merkleRoot(blockHashes) != getLe64(&leafBuf[leafBuf.size() - 8]))
+    {
+        std::cerr << "Block hash tree does not match its root, refusing transfer\n";
+        return false;
+    }
+
+    std::cout << "Receiving file: " << filename << " (" << fileSize << " bytes, "
+              << blockCount << " blocks)\n";
+    auto transferStart = std::chrono::steady_clock::now();
 
     // Generate output filename with _copy suffix
     std::string outFilename;
@@ -146,14 +475,25 @@ bool receiveFile(SOCKET sock)
     else
         outFilename = filename.substr(0, dot) + "_copy" + filename.substr(dot);
 
-    // Receive file data and write to disk
-    std::ofstream outfile(outFilename, std::ios::binary);
+    // Receive file data and write to disk (read/write so repaired blocks can be patched in place)
+    std::fstream outfile(outFilename, std::ios::in | std::ios::out | std::ios::trunc | std::ios::binary);
     if (!outfile)
     {
         std::cerr << "Cannot create output file: " << outFilename << "\n";
         return false;
     }
 
+    // Rename file to indicate corruption
+    auto markCorrupt = [&]()
+    {
+        outfile.close();
+        std::string corruptName = outFilename + ".corrupt";
+        if (std::rename(outFilename.c_str(), corruptName.c_str()) == 0)
+            std::cerr << "Saved corrupted file as: " << corruptName << "\n";
+        else
+            std::cerr << "Failed to rename corrupted file. Left as: " << outFilename << "\n";
+    };
+
     // CRC32 computation while receiving
     // Simple CRC32 implementation (polynomial 0xEDB88320)
     static uint32_t crc_table[256];
@@ -178,41 +518,131 @@ bool receiveFile(SOCKET sock)
         return c ^ 0xFFFFFFFFu;
     };
 
-    char chunk[CHUNK_SIZE];
-    long long recvd = 0;
+    auto blockLength = [&](uint32_t b) -> int
+    {
+        long long offset = (long long)b * blockSize;
+        return (fileSize - offset > blockSize) ? static_cast<int>(blockSize) : static_cast<int>(fileSize - offset);
+    };
+
+    std::vector<char> block(blockSize);
+    std::vector<uint32_t> badBlocks;
     uint32_t runningCrc = 0xFFFFFFFFu;
-    while (recvd < fileSize)
+    for (uint32_t b = 0; b < blockCount; ++b)
     {
-        int toRecv = (fileSize - recvd > CHUNK_SIZE) ? CHUNK_SIZE : static_cast<int>(fileSize - recvd);
-        if (!recvExactBytes(sock, chunk, toRecv))
+        int len = blockLength(b);
+        if (!recvExactBytes(sock, block.data(), len))
         {
             outfile.close();
             return false;
         }
-        outfile.write(chunk, toRecv);
+        if (xxh64(block.data(), static_cast<size_t>(len)) != blockHashes[b])
+        {
+            badBlocks.push_back(b);
+            if (badBlocks.size() > MAX_BAD_BLOCKS)
+            {
+                // Early abort: no point pulling the rest of a badly damaged stream
+                std::cerr << "Too many corrupt blocks (" << badBlocks.size() << "), aborting at block "
+                          << b << " of " << blockCount << "\n";
+                // Tell the sender before closing: it stops as soon as it sees REPAIR_ABORT. Drain
+                // until it does, since closing with its data unread would reset the connection
+                // and the abort could be lost with it.
+                char abortBuf[4];
+                putLe32(abortBuf, REPAIR_ABORT);
+                if (sendAllBytes(sock, abortBuf, 4))
+                {
+                    shutdown(sock, SD_SEND);
+                    while (recv(sock, block.data(), static_cast<int>(block.size()), 0) > 0)
+                        ;
+                }
+                markCorrupt();
+                return false;
+            }
+        }
+        outfile.write(block.data(), len);
         // Update CRC
-        runningCrc = crc32_update(runningCrc, chunk, toRecv);
-        recvd += toRecv;
+        runningCrc = crc32_update(runningCrc, block.data(), len);
+    }
+
+    // Re-request failed blocks until all verify or we run out of rounds
+    bool repaired = !badBlocks.empty();
+    for (int round = 0;; ++round)
+    {
+        char countBuf[4];
+        if (badBlocks.empty() || round == MAX_REPAIR_ROUNDS)
+        {
+            putLe32(countBuf, badBlocks.empty() ? 0 : REPAIR_ABORT);
+            sendAllBytes(sock, countBuf, 4);
+            break;
+        }
+
+        std::cerr << "Re-requesting " << badBlocks.size() << " corrupt block(s), round " << (round + 1) << "\n";
+        std::vector<char> request(4 + 4 * badBlocks.size());
+        putLe32(&request[0], static_cast<uint32_t>(badBlocks.size()));
+        for (size_t i = 0; i < badBlocks.size(); ++i)
+            putLe32(&request[4 + 4 * i], badBlocks[i]);
+        if (!sendAllBytes(sock, request.data(), static_cast<int>(request.size())))
+        {
+            markCorrupt();
+            return false;
+        }
+
+        std::vector<uint32_t> stillBad;
+        for (uint32_t b : badBlocks)
+        {
+            int len = blockLength(b);
+            if (!recvExactBytes(sock, block.data(), len))
+            {
+                markCorrupt();
+                return false;
+            }
+            if (xxh64(block.data(), static_cast<size_t>(len)) != blockHashes[b])
+            {
+                stillBad.push_back(b);
+                continue;
+            }
+            outfile.seekp((long long)b * blockSize, std::ios::beg);
+            outfile.write(block.data(), len);
+        }
+        badBlocks.swap(stillBad);
+    }
+
+    if (!badBlocks.empty())
+    {
+        std::cerr << badBlocks.size() << " block(s) still corrupt after " << MAX_REPAIR_ROUNDS << " repair rounds\n";
+        markCorrupt();
+        return false;
+    }
+
+    // Patched blocks invalidate the streaming CRC, so re-scan the final file
+    if (repaired)
+    {
+        outfile.flush();
+        outfile.seekg(0, std::ios::beg);
+        runningCrc = 0xFFFFFFFFu;
+        for (long long scanned = 0; scanned < fileSize;)
+        {
+            int toRead = (fileSize - scanned > blockSize) ? static_cast<int>(blockSize) : static_cast<int>(fileSize - scanned);
+            outfile.read(block.data(), toRead);
+            if (outfile.gcount() != toRead)
+                break;
+            runningCrc = crc32_update(runningCrc, block.data(), toRead);
+            scanned += toRead;
+        }
     }
 
     // finalize runningCrc (crc32_update already returns finalized form when given initial 0xFFFFFFFF)
     uint32_t computedCrc = runningCrc;
 
-    outfile.close();
-
     if (computedCrc != expectedCrc)
     {
         std::cerr << "File corruption detected! Expected CRC: 0x" << std::hex << expectedCrc
                   << ", Computed CRC: 0x" << computedCrc << std::dec << "\n";
-        // Rename file to indicate corruption
-        std::string corruptName = outFilename + ".corrupt";
-        if (std::rename(outFilename.c_str(), corruptName.c_str()) == 0)
-            std::cerr << "Saved corrupted file as: " << corruptName << "\n";
-        else
-            std::cerr << "Failed to rename corrupted file. Left as: " << outFilename << "\n";
+        markCorrupt();
         return false;
     }
 
+    outfile.close();
+    logThroughput("Received " + filename, fileSize, transferStart);
     std::cout << "File received and saved: " << outFilename << "\n";
     return true;
 }
@@ -230,9 +660,10 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    // Parse command-line args: listener.exe <sender_ip> [mode] [file_to_send]
+    // Parse command-line args: listener.exe <sender_ip> [mode] [file]
     // Modes: "send" (send file to sender on port 5051), "receive" (receive file from sender on port 5050)
     // Default: "both" (receive then send)
+    // In "receive" mode [file] names the catalog file to request (path or "#<id>"), otherwise the file to send
     const char *server_ip = "127.0.0.1";
     int port = PORT;
     std::string mode = "both";
@@ -269,6 +700,36 @@ int main(int argc, char *argv[])
 
     std::cout << "Listener mode: " << mode << "\n";
 
+    const char *tune = getenv("TRANSFER_TUNE");
+    tuningEnabled = !(tune && strcmp(tune, "0") == 0);
+    std::cout << "Connection tuning: " << (tuningEnabled ? "adaptive" : "off (TRANSFER_TUNE=0)") << "\n";
+
+    // TRANSFER_KEY selected the old pre-shared-key channel; TLS replaced it. Refuse rather than
+    // silently transfer in the clear.
+    if (getenv("TRANSFER_KEY"))
+    {
+        std::cerr << "TRANSFER_KEY is no longer supported; set TRANSFER_TLS_PIN to the fingerprint the sender prints\n";
+        WSACleanup();
+        return 1;
+    }
+    const char *pin = getenv("TRANSFER_TLS_PIN");
+    std::string tlsPin;
+    CredHandle tlsCredentials;
+    if (pin && *pin)
+    {
+        if (!parseFingerprint(pin, tlsPin))
+        {
+            std::cerr << "TRANSFER_TLS_PIN must be the 64-hex-digit SHA-256 fingerprint the sender prints at startup\n";
+            WSACleanup();
+            return 1;
+        }
+        if (!acquireTlsCredentials(NULL, tlsCredentials))
+        {
+            WSACleanup();
+            return 1;
+        }
+    }
+
     // Create socket
     if ((sock = socket(AF_INET, SOCK_STREAM, 0)) == INVALID_SOCKET)
     {
@@ -294,11 +755,25 @@ int main(int argc, char *argv[])
 
     std::cout << "Connected to sender!\n";
 
+    // TLS when TRANSFER_TLS_PIN names the sender's certificate fingerprint
+    TlsChannel channel;
+    if (!tlsPin.empty())
+    {
+        if (!channel.connect(sock, tlsCredentials, tlsPin))
+        {
+            closesocket(sock);
+            WSACleanup();
+            return 1;
+        }
+        activeChannel = &channel;
+        std::cout << "TLS established (" << channel.describe() << ")\n";
+    }
+
     // Execute based on mode
     if (mode == "receive")
     {
-        // Receive-only mode
-        if (!receiveFile(sock))
+        // Receive-only mode: request the named file (or the sender's default)
+        if (!sendFileRequest(sock, fileToSend) || !receiveFile(sock))
         {
             std::cerr << "Failed to receive file from sender\n";
         }
@@ -317,8 +792,8 @@ int main(int argc, char *argv[])
     }
     else if (mode == "both")
     {
-        // Bidirectional mode (old behavior): receive first, then send
-        if (!receiveFile(sock))
+        // Bidirectional mode (old behavior): receive the default file first, then send
+        if (!sendFileRequest(sock, "") || !receiveFile(sock))
         {
             std::cerr << "Failed to receive file from sender\n";
             closesocket(sock);
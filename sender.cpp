@@ -4,69 +4,1212 @@
 #include <sstream>
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#include <mstcpip.h>
+#include <ncrypt.h>
 #include <thread>
 #include <cstring>
 #include <queue>
+#include <deque>
 #include <vector>
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
 #include <functional>
 #include <cstdint>
+#include <climits>
 #include <cstdio>
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <shared_mutex>
+#include <io.h>
+#include <chrono>
+#include <cstdlib>
+#include <cctype>
+
+#include "transport.h"
 
 #pragma comment(lib, "ws2_32.lib") // link winsock library
+#pragma comment(lib, "ncrypt.lib")  // key for the TLS certificate
+
+#define PORT_RECEIVE 5050          // Port for receiving files from listener
+#define PORT_SEND 5051             // Port for sending files to listener
+#define CHUNK_SIZE 65536           // 64KB chunks for large files
+#define BLOCK_SIZE 1048576         // 1MB integrity blocks (one hash-tree leaf each)
+#define MAX_REPAIR_ROUNDS 3        // Block re-send rounds before giving up
+#define REPAIR_ABORT 0xFFFFFFFFu   // Repair count sent by a receiver that gave up
+#define MAX_CONCURRENT_THREADS 100 // Limit concurrent threads to avoid resource exhaustion
+#define DEFAULT_CACHE_MB 256       // RAM budget for the hot-file cache (0 disables it)
+#define DEFAULT_FILE "data.txt"    // Served when a listener doesn't ask for a specific file
+#define MAX_REQUEST_LEN 4096       // Longest file request accepted from a listener
+#define DEFAULT_UPLOAD_DIR "uploads" // Where listener uploads land; never served from the catalog
+#define NOT_FOUND 0xFFFFFFFFu      // Sent in place of filename_len when the request can't be served
+#define RTT_PROBE 0xFFFFFFFEu      // Sent in place of filename_len to time a round trip; echoed back
+#define MAX_WRITE_BACKLOG 67108864 // Upload bytes queued per disk writer before receivers wait
+#define MIN_CHUNK_SIZE 16384       // Adaptive chunk size bounds (CHUNK_SIZE is the starting point)
+#define MAX_CHUNK_SIZE 1048576
+#define MIN_SOCKET_BUFFER 65536    // Adaptive SO_SNDBUF bounds
+#define MAX_SOCKET_BUFFER 16777216
+#define TUNE_INTERVAL_MS 250       // How often a connection re-tunes itself
+#define TLS_CERT_SUBJECT "file-transfer-sender" // Subject of the sender's self-signed TLS certificate
+#define TLS_CERT_YEARS 5           // Validity of a newly created certificate
+
+// Little-endian encode/decode helpers
+void putLe32(char *buf, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        buf[i] = (v >> (i * 8)) & 0xFF;
+}
+
+void putLe64(char *buf, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        buf[i] = (v >> (i * 8)) & 0xFF;
+}
+
+uint32_t getLe32(const char *buf)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++)
+        v |= (uint32_t)(uint8_t)buf[i] << (i * 8);
+    return v;
+}
+
+// Adaptive tuning is on unless TRANSFER_TUNE=0, which keeps the fixed CHUNK_SIZE and the OS
+// socket defaults so benchmarks have an untuned baseline
+bool tuningEnabled = true;
+
+// Per-connection transport tuning. Every TUNE_INTERVAL_MS it samples delivery rate and the
+// RTT and picks an I/O chunk that carries ~10 ms of data. SO_SNDBUF is left to the stack's send
+// autotuning until a measured 2x bandwidth-delay product exceeds what the stack already buffers
+// (its ideal send backlog, or the current SO_SNDBUF); only then is it set, and kept at ~2x BDP
+// from there. The receive side only adapts its chunk: setting SO_RCVBUF on Windows turns off
+// receive window autotuning, which already does the job better.
+struct ConnectionTuner
+{
+    SOCKET sock;
+    bool sending;
+    bool enabled = tuningEnabled;
+    int chunkSize = CHUNK_SIZE;
+    int sendBuffer = 0;         // current SO_SNDBUF (sending side only)
+    bool sendBufferSet = false; // SO_SNDBUF is ours rather than the stack's default
+    double rttMs = 0;
+    double kernelRttMs = 0; // SIO_TCP_INFO estimate
+    double probeRttMs = 0;  // application-level round trip from probeRtt()
+    double rateMBs = 0;
+    long long lastBytes = 0;
+    std::chrono::steady_clock::time_point lastSample = std::chrono::steady_clock::now();
+
+    ConnectionTuner(SOCKET s, bool isSending) : sock(s), sending(isSending)
+    {
+        if (!enabled)
+            return;
+
+        // No Nagle: bulk data goes out in full chunks anyway, and the small control messages
+        // (file requests, repair lists) must not wait behind a delayed ACK
+        BOOL noDelay = TRUE;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&noDelay, sizeof(noDelay));
+
+        if (sending)
+        {
+            int len = sizeof(sendBuffer);
+            getsockopt(sock, SOL_SOCKET, SO_SNDBUF, (char *)&sendBuffer, &len);
+        }
+    }
+
+    // Time one application-level round trip before the header goes out: RTT_PROBE is sent where
+    // the receiver expects a filename length, and the receiver echoes it. A proxy or WAN emulator
+    // that terminates TCP hides the path RTT from SIO_TCP_INFO, but not from this probe.
+    // Returns false if the connection failed.
+    bool probeRtt()
+    {
+        if (!enabled)
+            return true;
+        char probe[4], echo[4];
+        putLe32(probe, RTT_PROBE);
+        auto start = std::chrono::steady_clock::now();
+        if (!sendAllBytes(sock, probe, 4) || !recvExactBytes(sock, echo, 4))
+            return false;
+        if (getLe32(echo) != RTT_PROBE)
+        {
+            std::cerr << "Peer did not answer the RTT probe\n";
+            return false;
+        }
+        lastSample = std::chrono::steady_clock::now(); // the probe's wait isn't transfer time
+        probeRttMs = std::chrono::duration<double, std::milli>(lastSample - start).count();
+        return true;
+    }
+
+    // Report progress (total bytes moved so far); re-tunes when a sample interval has passed
+    void onProgress(long long bytesDone)
+    {
+        if (!enabled)
+            return;
+        auto now = std::chrono::steady_clock::now();
+        double elapsedMs = std::chrono::duration<double, std::milli>(now - lastSample).count();
+        if (elapsedMs < TUNE_INTERVAL_MS)
+            return;
+
+        rateMBs = (bytesDone - lastBytes) / elapsedMs * 1000.0 / (1024 * 1024);
+        lastBytes = bytesDone;
+        lastSample = now;
+        double bytesPerMs = rateMBs * 1024 * 1024 / 1000.0;
+
+        double rtt = sampleRttMs();
+        if (rtt > 0)
+            kernelRttMs = rtt;
+        // The kernel sees only the first hop when something terminates TCP on the way,
+        // so trust whichever estimate shows the longer path
+        rttMs = std::max(kernelRttMs, probeRttMs);
+
+        // Chunk: ~10 ms of data per call, power of two within [MIN_CHUNK_SIZE, MAX_CHUNK_SIZE]
+        int chunk = MIN_CHUNK_SIZE;
+        while (chunk < MAX_CHUNK_SIZE && chunk < bytesPerMs * 10)
+            chunk *= 2;
+        bool changed = chunk != chunkSize;
+        chunkSize = chunk;
+
+        // Send buffer: 2x BDP so the window never starves while we're in a syscall. Setting
+        // SO_SNDBUF turns off the stack's send autotuning, so don't until it falls short.
+        if (sending && rttMs > 0)
+        {
+            double bdp = bytesPerMs * rttMs;
+            int buffer = static_cast<int>(std::min<double>(MAX_SOCKET_BUFFER, std::max<double>(MIN_SOCKET_BUFFER, 2 * bdp)));
+            int stackBuffer = idealSendBacklog();
+            if (sendBufferSet)
+                buffer = std::max(buffer, stackBuffer);
+            else if (buffer <= std::max(sendBuffer, stackBuffer) * 5 / 4)
+                buffer = sendBuffer; // the stack already buffers enough
+            if (buffer > sendBuffer * 5 / 4 || buffer < sendBuffer * 3 / 4)
+            {
+                applySendBuffer(buffer);
+                changed = true;
+            }
+        }
+
+        if (changed)
+        {
+            std::cout << "Tuned " << (sending ? "send" : "receive") << ": rtt " << rttMs << " ms (kernel "
+                      << kernelRttMs << ", probe " << probeRttMs << "), rate " << rateMBs << " MB/s, chunk "
+                      << chunkSize << " bytes";
+            if (sending)
+                std::cout << ", SO_SNDBUF " << sendBuffer << " bytes";
+            std::cout << "\n";
+        }
+    }
+
+private:
+    void applySendBuffer(int size)
+    {
+        if (size > 0 && setsockopt(sock, SOL_SOCKET, SO_SNDBUF, (const char *)&size, sizeof(size)) == 0)
+        {
+            sendBuffer = size;
+            sendBufferSet = true;
+        }
+    }
+
+    // Smoothed RTT from the TCP stack, or 0 if this Windows version can't report it
+    double sampleRttMs()
+    {
+#ifdef SIO_TCP_INFO
+        DWORD version = 0;
+        TCP_INFO_v0 info;
+        DWORD bytes = 0;
+        if (WSAIoctl(sock, SIO_TCP_INFO, &version, sizeof(version), &info, sizeof(info), &bytes, NULL, NULL) == 0)
+            return info.RttUs / 1000.0;
+#endif
+        return 0;
+    }
+
+    // Bytes the stack wants queued to keep the pipe full (its own BDP estimate)
+    int idealSendBacklog()
+    {
+#ifdef SIO_IDEAL_SEND_BACKLOG_QUERY
+        ULONG isb = 0;
+        DWORD bytes = 0;
+        if (WSAIoctl(sock, SIO_IDEAL_SEND_BACKLOG_QUERY, NULL, 0, &isb, sizeof(isb), &bytes, NULL, NULL) == 0)
+            return static_cast<int>(std::min<ULONG>(isb, MAX_SOCKET_BUFFER));
+#endif
+        return 0;
+    }
+};
+
+// Read the 4-byte length that starts a transfer header, echoing any RTT probes sent ahead of it
+bool recvHeaderLength(SOCKET sock, char *lenBuf)
+{
+    while (true)
+    {
+        if (!recvExactBytes(sock, lenBuf, 4))
+            return false;
+        if (getLe32(lenBuf) != RTT_PROBE)
+            return true;
+        if (!sendAllBytes(sock, lenBuf, 4))
+            return false;
+    }
+}
+
+// xxHash64 (block hash for the integrity tree)
+static inline uint64_t rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+uint64_t xxh64(const char *data, size_t len, uint64_t seed = 0)
+{
+    const uint64_t P1 = 0x9E3779B185EBCA87ULL, P2 = 0xC2B2AE3D27D4EB4FULL, P3 = 0x165667B19E3779F9ULL;
+    const uint64_t P4 = 0x85EBCA77C2B2AE63ULL, P5 = 0x27D4EB2F165667C5ULL;
+    auto read64 = [](const char *p) { uint64_t v; memcpy(&v, p, 8); return v; };
+    auto read32 = [](const char *p) { uint32_t v; memcpy(&v, p, 4); return v; };
+    auto mixRound = [&](uint64_t acc, uint64_t input) { return rotl64(acc + input * P2, 31) * P1; };
+
+    const char *p = data;
+    const char *end = data + len;
+    uint64_t h;
+    if (len >= 32)
+    {
+        uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+        for (; p + 32 <= end; p += 32)
+        {
+            v1 = mixRound(v1, read64(p));
+            v2 = mixRound(v2, read64(p + 8));
+            v3 = mixRound(v3, read64(p + 16));
+            v4 = mixRound(v4, read64(p + 24));
+        }
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        for (uint64_t v : {v1, v2, v3, v4})
+            h = (h ^ mixRound(0, v)) * P1 + P4;
+    }
+    else
+        h = seed + P5;
+
+    h += (uint64_t)len;
+    for (; p + 8 <= end; p += 8)
+        h = rotl64(h ^ mixRound(0, read64(p)), 27) * P1 + P4;
+    if (p + 4 <= end)
+    {
+        h = rotl64(h ^ ((uint64_t)read32(p) * P1), 23) * P2 + P3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+        h = rotl64(h ^ ((uint64_t)(uint8_t)*p * P5), 11) * P1;
+
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+// Fold block hashes pairwise up to a single root (odd node is carried up)
+uint64_t merkleRoot(std::vector<uint64_t> level)
+{
+    if (level.empty())
+        return xxh64(nullptr, 0);
+    while (level.size() > 1)
+    {
+        std::vector<uint64_t> next;
+        for (size_t i = 0; i < level.size(); i += 2)
+        {
+            if (i + 1 == level.size())
+            {
+                next.push_back(level[i]);
+                break;
+            }
+            char pair[16];
+            putLe64(pair, level[i]);
+            putLe64(pair + 8, level[i + 1]);
+            next.push_back(xxh64(pair, 16));
+        }
+        level.swap(next);
+    }
+    return level[0];
+}
+
+// CRC32 (polynomial 0xEDB88320) so receiver can verify whole-file integrity
+uint32_t crc32Update(uint32_t crc, const char *buf, size_t len)
+{
+    static uint32_t crc_table[256];
+    static std::once_flag crc_table_init;
+    std::call_once(crc_table_init, []
+                   {
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t c = i;
+            for (int j = 0; j < 8; ++j)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : (c >> 1);
+            crc_table[i] = c;
+        } });
+
+    uint32_t c = crc ^ 0xFFFFFFFFu;
+    for (size_t k = 0; k < len; ++k)
+        c = crc_table[(c ^ (unsigned char)buf[k]) & 0xFFu] ^ (c >> 8);
+    return c ^ 0xFFFFFFFFu;
+}
+
+// Run hashStripe(first, stride) on up to one thread per core, covering blockCount blocks
+void forEachBlockStripe(long long blockCount, const std::function<void(long long, int)> &hashStripe)
+{
+    unsigned hw = std::thread::hardware_concurrency();
+    int workerCount = static_cast<int>(std::min<long long>(blockCount, hw ? hw : 2));
+    std::vector<std::thread> hashers;
+    for (int t = 1; t < workerCount; ++t)
+        hashers.push_back(std::thread(hashStripe, t, workerCount));
+    if (workerCount > 0)
+        hashStripe(0, workerCount);
+    for (auto &h : hashers)
+        h.join();
+}
+
+// CRC and hash every BLOCK_SIZE block of a file in one sequential read.
+// This thread reads each block once and runs the CRC over it, then hands the buffer to a
+// hashing worker, so the disk sees a single forward scan while hashing still uses every core.
+bool scanFileBlocks(std::ifstream &in, long long fileSize, uint32_t &fileCrc, std::vector<uint64_t> &hashes)
+{
+    long long blockCount = (fileSize + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    hashes.assign(static_cast<size_t>(blockCount), 0);
+    unsigned hw = std::thread::hardware_concurrency();
+    int workerCount = static_cast<int>(std::min<long long>(blockCount, hw ? hw : 2));
+
+    struct Job
+    {
+        long long block;
+        int len;
+        std::vector<char> data;
+    };
+    std::deque<Job> pending;              // read and CRC'd, waiting for a hasher
+    std::vector<std::vector<char>> spare; // hashed buffers ready for the next read
+    size_t buffers = 0;                   // allocated so far (at most two per worker)
+    bool finished = false;
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    std::vector<std::thread> hashers;
+    for (int t = 0; t < workerCount; ++t)
+        hashers.push_back(std::thread([&]
+                                      {
+            while (true)
+            {
+                Job job;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [&]
+                            { return !pending.empty() || finished; });
+                    if (pending.empty())
+                        return;
+                    job = std::move(pending.front());
+                    pending.pop_front();
+                }
+                hashes[static_cast<size_t>(job.block)] = xxh64(job.data.data(), static_cast<size_t>(job.len));
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    spare.push_back(std::move(job.data));
+                }
+                cv.notify_all();
+            } }));
+
+    uint32_t crc = 0xFFFFFFFFu;
+    bool ok = true;
+    for (long long b = 0; b < blockCount; ++b)
+    {
+        std::vector<char> buf;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&]
+                    { return !spare.empty() || buffers < 2 * static_cast<size_t>(workerCount); });
+            if (!spare.empty())
+            {
+                buf = std::move(spare.back());
+                spare.pop_back();
+            }
+            else
+                buffers++;
+        }
+        buf.resize(BLOCK_SIZE);
+
+        long long offset = b * BLOCK_SIZE;
+        int len = (fileSize - offset > BLOCK_SIZE) ? BLOCK_SIZE : static_cast<int>(fileSize - offset);
+        in.read(buf.data(), len);
+        if (in.gcount() != len)
+        {
+            ok = false;
+            break;
+        }
+        crc = crc32Update(crc, buf.data(), static_cast<size_t>(len));
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.push_back(Job{b, len, std::move(buf)});
+        }
+        cv.notify_all();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished = true;
+    }
+    cv.notify_all();
+    for (auto &h : hashers)
+        h.join();
+    fileCrc = crc;
+    return ok;
+}
+
+// Hash every BLOCK_SIZE block of an in-memory file, spreading blocks across cores
+std::vector<uint64_t> hashMemoryBlocks(const char *data, long long size)
+{
+    long long blockCount = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    std::vector<uint64_t> hashes(static_cast<size_t>(blockCount));
+    forEachBlockStripe(blockCount, [&](long long first, int stride)
+                       {
+        for (long long b = first; b < blockCount; b += stride)
+        {
+            long long offset = b * BLOCK_SIZE;
+            long long len = std::min<long long>(BLOCK_SIZE, size - offset);
+            hashes[static_cast<size_t>(b)] = xxh64(data + offset, static_cast<size_t>(len));
+        } });
+    return hashes;
+}
+
+// Build everything that precedes the file data on the wire:
+// [4-byte filename_len][filename][8-byte file_size][4-byte crc32]
+// [4-byte block_size][4-byte block_count][block_count x 8-byte block hash][8-byte root hash]
+std::vector<char> buildTransferHeader(const std::string &filename, long long fileSize, uint32_t fileCrc,
+                                      const std::vector<uint64_t> &blockHashes)
+{
+    size_t fnLen = filename.size();
+    std::vector<char> header(4 + fnLen + 8 + 4 + 8 + 8 * blockHashes.size() + 8);
+    char *p = header.data();
+    putLe32(p, static_cast<uint32_t>(fnLen));
+    memcpy(p + 4, filename.data(), fnLen);
+    p += 4 + fnLen;
+    putLe64(p, static_cast<uint64_t>(fileSize));
+    putLe32(p + 8, fileCrc);
+    putLe32(p + 12, BLOCK_SIZE);
+    putLe32(p + 16, static_cast<uint32_t>(blockHashes.size()));
+    p += 20;
+    for (uint64_t h : blockHashes)
+    {
+        putLe64(p, h);
+        p += 8;
+    }
+    putLe64(p, merkleRoot(blockHashes));
+    return header;
+}
+
+// Helper: send several buffers with one gather call (falls back to per-buffer sends on short writes)
+bool sendGather(SOCKET sock, WSABUF *bufs, DWORD count)
+{
+    if (activeChannel) // TLS encrypts in process, so cached bytes are copied into records
+    {
+        for (DWORD i = 0; i < count; ++i)
+            if (!sendAllBytes(sock, bufs[i].buf, static_cast<int>(bufs[i].len)))
+                return false;
+        return true;
+    }
+
+    DWORD sent = 0;
+    if (WSASend(sock, bufs, count, &sent, 0, NULL, NULL) == SOCKET_ERROR)
+    {
+        std::cerr << "Send error: " << WSAGetLastError() << "\n";
+        return false;
+    }
+    for (DWORD i = 0; i < count; ++i)
+    {
+        DWORD done = std::min<DWORD>(sent, bufs[i].len);
+        sent -= done;
+        if (done < bufs[i].len && !sendAllBytes(sock, bufs[i].buf + done, static_cast<int>(bufs[i].len - done)))
+            return false;
+    }
+    return true;
+}
+
+// True if the receiver has already replied while file data is still going out. The only thing
+// it sends that early is REPAIR_ABORT (too many bad blocks), so the rest of the stream is wasted.
+bool receiverAborted(SOCKET sock, const std::string &filename)
+{
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(sock, &readable);
+    timeval noWait = {0, 0};
+    if (select(static_cast<int>(sock) + 1, &readable, NULL, NULL, &noWait) <= 0)
+        return false;
+    char countBuf[4];
+    if (recvExactBytes(sock, countBuf, 4) && getLe32(countBuf) == REPAIR_ABORT)
+        std::cerr << "Receiver aborted transfer of " << filename << " (too many corrupt blocks)\n";
+    else
+        std::cerr << "Unexpected reply from receiver during transfer of " << filename << "\n";
+    return true;
+}
+
+// Serve block re-send requests until the receiver has verified every block.
+// readBlock(offset, len) returns the block bytes, or nullptr if they can't be read.
+bool serveBlockRepairs(SOCKET sock, const std::string &filename, long long fileSize,
+                       const std::function<const char *(long long, int)> &readBlock)
+{
+    uint32_t blockCount = static_cast<uint32_t>((fileSize + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    for (int round = 0; round <= MAX_REPAIR_ROUNDS; ++round)
+    {
+        char countBuf[4];
+        if (!recvExactBytes(sock, countBuf, 4))
+            return false;
+        uint32_t badCount = getLe32(countBuf);
+        if (badCount == 0)
+            return true;
+        if (badCount == REPAIR_ABORT || badCount > blockCount)
+        {
+            std::cerr << "Receiver rejected file: " << filename << "\n";
+            return false;
+        }
+        if (round == MAX_REPAIR_ROUNDS)
+        {
+            std::cerr << "Too many repair rounds for " << filename << "\n";
+            return false;
+        }
+
+        std::vector<char> indexBuf(4 * static_cast<size_t>(badCount));
+        if (!recvExactBytes(sock, indexBuf.data(), static_cast<int>(indexBuf.size())))
+            return false;
+        std::cout << "Re-sending " << badCount << " corrupt block(s) of " << filename << "\n";
+
+        for (uint32_t i = 0; i < badCount; ++i)
+        {
+            uint32_t b = getLe32(&indexBuf[4 * i]);
+            if (b >= blockCount)
+                return false;
+            long long offset = (long long)b * BLOCK_SIZE;
+            int len = (fileSize - offset > BLOCK_SIZE) ? BLOCK_SIZE : static_cast<int>(fileSize - offset);
+            const char *data = readBlock(offset, len);
+            if (!data || !sendAllBytes(sock, data, len))
+                return false;
+        }
+    }
+    return false;
+}
+
+// One servable file under the catalog root. IDs are assigned in scan order and never reused.
+struct CatalogEntry
+{
+    uint32_t id = 0;
+    std::string relPath;  // '/'-separated, relative to the root, as cased on disk
+    std::string name;     // last path component, sent on the wire
+    std::string fullPath; // root + "/" + relPath
+    long long size = 0;
+    uint64_t mtime = 0; // FILETIME ticks
+};
+
+// In-memory index of every file under the served root directory.
+// Built once by a directory scan and kept current by a change-notification thread,
+// so serving a request is a hash lookup and never touches the filesystem.
+struct Catalog
+{
+    std::string root;
+    std::string longRoot; // root with any 8.3 components expanded, to relativize watcher paths
+    std::string excludedDir; // directory never served even when under the root (the upload directory)
+    std::string excludedKey; // pathKey of excludedDir relative to the root, "" if it lies outside
+    std::unordered_map<std::string, std::shared_ptr<const CatalogEntry>> byPath; // keyed by pathKey()
+    std::vector<std::shared_ptr<const CatalogEntry>> byId; // nullptr once a file is removed
+    std::shared_mutex mutex;
+
+    // Directory tree over byPath, so deleting a file, a directory or a short-named entry only
+    // touches what lives under it. Keyed by pathKey(), "" = root; a directory is listed while
+    // anything is indexed beneath it.
+    struct DirNode
+    {
+        std::unordered_set<std::string> files;   // keys of files directly inside
+        std::unordered_set<std::string> subdirs; // keys of child directories
+    };
+    std::unordered_map<std::string, DirNode> dirs;
+
+    struct ScanItem
+    {
+        std::string relPath;
+        long long size;
+        uint64_t mtime;
+    };
+
+    static uint64_t fileTimeTicks(const FILETIME &ft)
+    {
+        return ((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    }
+
+    static long long fileSizeOf(DWORD high, DWORD low)
+    {
+        return static_cast<long long>(((uint64_t)high << 32) | low);
+    }
+
+    // NTFS names are case-insensitive, so "Data.txt" and "data.txt" must map to one entry
+    static std::string pathKey(std::string relPath)
+    {
+        std::replace(relPath.begin(), relPath.end(), '\\', '/');
+        std::transform(relPath.begin(), relPath.end(), relPath.begin(), [](unsigned char c)
+                       { return static_cast<char>(tolower(c)); });
+        return relPath;
+    }
+
+    static std::string parentKey(const std::string &key)
+    {
+        size_t slash = key.find_last_of('/');
+        return slash == std::string::npos ? "" : key.substr(0, slash);
+    }
+
+    static std::string longPathOf(const std::string &path)
+    {
+        DWORD len = GetLongPathNameA(path.c_str(), NULL, 0);
+        if (len == 0)
+            return "";
+        std::string out(len, '\0');
+        len = GetLongPathNameA(path.c_str(), &out[0], len);
+        out.resize(len);
+        return out;
+    }
+
+    static std::string fullPathOf(const std::string &path)
+    {
+        char buf[MAX_PATH];
+        DWORD len = GetFullPathNameA(path.c_str(), MAX_PATH, buf, NULL);
+        std::string out = (len > 0 && len < MAX_PATH) ? std::string(buf, len) : path;
+        while (out.size() > 1 && (out.back() == '/' || out.back() == '\\'))
+            out.pop_back();
+        return out;
+    }
+
+    // Paths never indexed: the upload directory, so half-written (.part) or just-received
+    // files are never served. main() refuses an upload directory that contains the root.
+    bool ignored(const std::string &relPath) const
+    {
+        if (excludedKey.empty())
+            return false;
+        std::string key = pathKey(relPath);
+        return key == excludedKey || key.compare(0, excludedKey.size() + 1, excludedKey + "/") == 0;
+    }
+
+    // The watcher may report 8.3 short names (DATA~1.TXT); map them to the long relative path
+    std::string resolveShortName(const std::string &relPath)
+    {
+        if (relPath.find('~') == std::string::npos)
+            return relPath;
+        std::string full = longPathOf(root + "/" + relPath);
+        std::string key = pathKey(full), rootKey = pathKey(longRoot) + "/";
+        if (full.empty() || longRoot.empty() || key.compare(0, rootKey.size(), rootKey) != 0)
+            return relPath; // gone already, or outside the root
+        std::string rel = full.substr(rootKey.size());
+        std::replace(rel.begin(), rel.end(), '\\', '/');
+        return rel;
+    }
+
+    // Walk relDir (relative to root) recursively using the directory listing's own size/mtime
+    void scanTree(const std::string &relDir, std::vector<ScanItem> &out)
+    {
+        std::vector<std::string> pending{relDir};
+        while (!pending.empty())
+        {
+            std::string dir = pending.back();
+            pending.pop_back();
+            std::string pattern = root + "/" + (dir.empty() ? "" : dir + "/") + "*";
+
+            WIN32_FIND_DATAA fd;
+            HANDLE h = FindFirstFileExA(pattern.c_str(), FindExInfoBasic, &fd, FindExSearchNameMatch,
+                                        NULL, FIND_FIRST_EX_LARGE_FETCH);
+            if (h == INVALID_HANDLE_VALUE)
+                continue;
+            do
+            {
+                if (strcmp(fd.cFileName, ".") == 0 || strcmp(fd.cFileName, "..") == 0)
+                    continue;
+                std::string rel = dir.empty() ? fd.cFileName : dir + "/" + fd.cFileName;
+                if (ignored(rel))
+                    continue;
+                if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+                {
+                    if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) // don't follow links out of the root
+                        pending.push_back(rel);
+                    continue;
+                }
+                out.push_back(ScanItem{rel, fileSizeOf(fd.nFileSizeHigh, fd.nFileSizeLow), fileTimeTicks(fd.ftLastWriteTime)});
+            } while (FindNextFileA(h, &fd));
+            FindClose(h);
+        }
+    }
+
+    // Insert or replace one entry (caller holds the write lock)
+    void upsert(const ScanItem &item)
+    {
+        auto entry = std::make_shared<CatalogEntry>();
+        entry->relPath = item.relPath;
+        size_t slash = item.relPath.find_last_of('/');
+        entry->name = (slash == std::string::npos) ? item.relPath : item.relPath.substr(slash + 1);
+        entry->fullPath = root + "/" + item.relPath;
+        entry->size = item.size;
+        entry->mtime = item.mtime;
+
+        std::string key = pathKey(item.relPath);
+        auto it = byPath.find(key);
+        if (it != byPath.end())
+        {
+            entry->id = it->second->id;
+            it->second = entry;
+        }
+        else
+        {
+            entry->id = static_cast<uint32_t>(byId.size());
+            byPath.emplace(key, entry);
+            std::string dir = parentKey(key);
+            dirs[dir].files.insert(key);
+            for (; !dir.empty(); dir = parentKey(dir))
+                if (!dirs[parentKey(dir)].subdirs.insert(dir).second)
+                    break; // the rest of the chain is already linked
+        }
+        if (entry->id == byId.size())
+            byId.push_back(entry);
+        else
+            byId[entry->id] = entry;
+    }
+
+    // Drop one indexed file and any directories it leaves empty (caller holds the write lock)
+    std::unordered_map<std::string, std::shared_ptr<const CatalogEntry>>::iterator
+    erase(std::unordered_map<std::string, std::shared_ptr<const CatalogEntry>>::iterator it)
+    {
+        std::string dir = parentKey(it->first);
+        dirs[dir].files.erase(it->first);
+        while (!dir.empty())
+        {
+            auto node = dirs.find(dir);
+            if (node == dirs.end() || !node->second.files.empty() || !node->second.subdirs.empty())
+                break;
+            dirs.erase(node);
+            std::string parent = parentKey(dir);
+            dirs[parent].subdirs.erase(dir);
+            dir = parent;
+        }
+        byId[it->second->id] = nullptr;
+        return byPath.erase(it);
+    }
+
+    // Drop a file, or every file under a directory (caller holds the write lock)
+    void removePath(const std::string &relPath)
+    {
+        std::string key = pathKey(relPath);
+        auto it = byPath.find(key);
+        if (it != byPath.end())
+        {
+            erase(it);
+            return;
+        }
+        if (!dirs.count(key))
+            return; // never indexed
+
+        std::vector<std::string> doomed, pending{key};
+        while (!pending.empty())
+        {
+            const DirNode &node = dirs[pending.back()];
+            pending.pop_back();
+            doomed.insert(doomed.end(), node.files.begin(), node.files.end());
+            pending.insert(pending.end(), node.subdirs.begin(), node.subdirs.end());
+        }
+        for (const std::string &file : doomed)
+            erase(byPath.find(file));
+    }
+
+    // Drop entries directly under relDir whose files are gone. Used when a deleted file was
+    // reported by its short name, which can no longer be resolved (caller holds the write lock).
+    void pruneMissing(const std::string &relDir)
+    {
+        auto node = dirs.find(pathKey(relDir));
+        if (node == dirs.end())
+            return;
+        std::vector<std::string> gone;
+        for (const std::string &file : node->second.files)
+        {
+            WIN32_FILE_ATTRIBUTE_DATA attrs;
+            if (!GetFileAttributesExA(byPath[file]->fullPath.c_str(), GetFileExInfoStandard, &attrs))
+                gone.push_back(file);
+        }
+        for (const std::string &file : gone)
+            erase(byPath.find(file));
+    }
+
+    // Full scan of the root; returns the number of files indexed
+    size_t load(const std::string &rootDir)
+    {
+        root = rootDir;
+        while (root.size() > 1 && (root.back() == '/' || root.back() == '\\'))
+            root.pop_back();
+        longRoot = longPathOf(root);
+        if (!excludedDir.empty())
+        {
+            std::string rootKey = pathKey(fullPathOf(root)) + "/";
+            std::string dirKey = pathKey(fullPathOf(excludedDir));
+            excludedKey = dirKey.compare(0, rootKey.size(), rootKey) == 0 ? dirKey.substr(rootKey.size()) : "";
+        }
+
+        std::vector<ScanItem> items;
+        scanTree("", items);
+
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        bool rescan = !byPath.empty();
+        std::unordered_set<std::string> seen;
+        byPath.reserve(byPath.size() + items.size());
+        for (const ScanItem &item : items)
+        {
+            upsert(item); // existing paths keep their IDs
+            if (rescan)
+                seen.insert(pathKey(item.relPath));
+        }
+        for (auto it = byPath.begin(); rescan && it != byPath.end();)
+        {
+            if (seen.count(it->first))
+            {
+                ++it;
+                continue;
+            }
+            it = erase(it);
+        }
+        return byPath.size();
+    }
+
+    // Re-check one changed path reported by the watcher
+    void refresh(const std::string &changedPath)
+    {
+        std::string relPath = resolveShortName(changedPath);
+        if (ignored(relPath))
+            return;
+        WIN32_FILE_ATTRIBUTE_DATA attrs;
+        std::string full = root + "/" + relPath;
+        if (!GetFileAttributesExA(full.c_str(), GetFileExInfoStandard, &attrs))
+        {
+            size_t slash = relPath.find_last_of('/');
+            std::string parent = (slash == std::string::npos) ? "" : relPath.substr(0, slash);
+            bool shortName = relPath.find('~', parent.size()) != std::string::npos;
+            std::unique_lock<std::shared_mutex> lock(mutex);
+            if (shortName && !byPath.count(pathKey(relPath)))
+                pruneMissing(parent);
+            else
+                removePath(relPath);
+            return;
+        }
+
+        std::vector<ScanItem> items;
+        if (attrs.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            scanTree(relPath, items); // directory created or renamed into the tree
+        else
+            items.push_back(ScanItem{relPath, fileSizeOf(attrs.nFileSizeHigh, attrs.nFileSizeLow),
+                                     fileTimeTicks(attrs.ftLastWriteTime)});
+
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        for (const ScanItem &item : items)
+            upsert(item);
+    }
+
+    // Resolve a request: "" = default file, "#<id>" = catalog ID, anything else = relative path
+    std::shared_ptr<const CatalogEntry> lookup(std::string request)
+    {
+        if (request.empty())
+            request = DEFAULT_FILE;
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        if (request[0] == '#')
+        {
+            char *end = nullptr;
+            unsigned long id = strtoul(request.c_str() + 1, &end, 10);
+            if (end == request.c_str() + 1 || *end != '\0' || id >= byId.size())
+                return nullptr;
+            return byId[id];
+        }
+        auto it = byPath.find(pathKey(request));
+        return it == byPath.end() ? nullptr : it->second;
+    }
+
+    size_t fileCount()
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        return byPath.size();
+    }
+
+    // Apply change notifications for the whole tree until the handle fails
+    void watch()
+    {
+        HANDLE dir = CreateFileA(root.c_str(), FILE_LIST_DIRECTORY,
+                                 FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                 NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+        if (dir == INVALID_HANDLE_VALUE)
+        {
+            std::cerr << "Catalog: cannot watch " << root << ", index will not track changes\n";
+            return;
+        }
+
+        std::vector<DWORD> buf(16384); // 64KB, DWORD-aligned as the API requires
+        while (true)
+        {
+            DWORD bytes = 0;
+            if (!ReadDirectoryChangesW(dir, buf.data(), static_cast<DWORD>(buf.size() * sizeof(DWORD)), TRUE,
+                                       FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME |
+                                           FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE,
+                                       &bytes, NULL, NULL))
+            {
+                std::cerr << "Catalog: change notifications stopped (" << GetLastError() << ")\n";
+                break;
+            }
+            if (bytes == 0)
+            {
+                // Notification buffer overflowed: changes were lost, rescan everything
+                std::cout << "Catalog: change buffer overflow, rescanning " << root << "\n";
+                load(root);
+                continue;
+            }
 
-#define PORT_RECEIVE 5050          // Port for receiving files from listener
-#define PORT_SEND 5051             // Port for sending files to listener
-#define CHUNK_SIZE 65536           // 64KB chunks for large files
-#define MAX_CONCURRENT_THREADS 100 // Limit concurrent threads to avoid resource exhaustion
+            const char *p = reinterpret_cast<const char *>(buf.data());
+            while (true)
+            {
+                const FILE_NOTIFY_INFORMATION *info = reinterpret_cast<const FILE_NOTIFY_INFORMATION *>(p);
+                int wlen = static_cast<int>(info->FileNameLength / sizeof(WCHAR));
+                int len = WideCharToMultiByte(CP_ACP, 0, info->FileName, wlen, NULL, 0, NULL, NULL);
+                std::string rel(len, '\0');
+                WideCharToMultiByte(CP_ACP, 0, info->FileName, wlen, &rel[0], len, NULL, NULL);
+                std::replace(rel.begin(), rel.end(), '\\', '/');
+                refresh(rel);
+
+                if (info->NextEntryOffset == 0)
+                    break;
+                p += info->NextEntryOffset;
+            }
+        }
+        CloseHandle(dir);
+    }
+};
+
+Catalog catalog;
+
+// A file held in memory with its wire header (name, size, CRC, hash tree) precomputed
+struct CachedFile
+{
+    std::string filepath;
+    long long size = 0;
+    uint64_t mtime = 0;
+    std::vector<char> header;
+    std::vector<char> data;
+
+    size_t footprint() const { return header.size() + data.size() + filepath.size(); }
+};
 
-// Helper: send all bytes from buf
-bool sendAllBytes(SOCKET sock, const char *buf, int len)
+// LRU cache of hot files under a fixed RAM budget.
+// Entries are shared_ptr so an eviction never pulls data out from under an in-flight send.
+struct FileCache
 {
-    int total = 0;
-    while (total < len)
+    size_t budgetBytes = 0;
+    size_t maxEntryBytes = 0;
+    size_t usedBytes = 0;
+    std::list<std::shared_ptr<const CachedFile>> lru; // front = most recently used
+    std::unordered_map<std::string, std::list<std::shared_ptr<const CachedFile>>::iterator> index;
+    std::mutex mutex;
+    std::atomic<long long> hits{0};
+    std::atomic<long long> misses{0};
+    std::atomic<long long> oversized{0}; // requests for files above maxEntryBytes, streamed uncached
+
+    void configure(size_t budget)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        budgetBytes = budget;
+        // One huge file shouldn't flush everything else, and a cached file goes out through
+        // int-sized sends and a ULONG WSABUF length, so it must also fit an int
+        maxEntryBytes = std::min<size_t>(budget / 4, INT_MAX);
+        evictTo(budgetBytes);
+    }
+
+    // Return the cached file if present and matching the catalog's size/mtime, loading it on a miss.
+    // Returns nullptr when the file is too big to cache (caller streams it instead).
+    std::shared_ptr<const CachedFile> acquire(const CatalogEntry &file)
     {
-        int sent = send(sock, buf + total, len - total, 0);
-        if (sent == SOCKET_ERROR)
+        if (budgetBytes == 0)
+            return nullptr;
+
+        const std::string &filepath = file.fullPath;
+        long long size = file.size;
+        uint64_t mtime = file.mtime;
         {
-            int err = WSAGetLastError();
-            std::cerr << "Send error: " << err << " (WSAECONNRESET=" << WSAECONNRESET
-                      << ", WSAECONNABORTED=" << WSAECONNABORTED << ")\n";
-            return false;
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = index.find(filepath);
+            if (it != index.end())
+            {
+                const CachedFile &entry = **it->second;
+                if (entry.size == size && entry.mtime == mtime)
+                {
+                    lru.splice(lru.begin(), lru, it->second);
+                    hits++;
+                    return *it->second;
+                }
+                remove(it); // catalog saw it change on disk
+            }
         }
-        if (sent == 0)
+        if (static_cast<size_t>(size) > maxEntryBytes)
         {
-            std::cerr << "Send returned 0 (connection closed by remote)\n";
-            return false;
+            oversized++; // can never be cached, so not counted as a miss
+            return nullptr;
         }
-        total += sent;
+        misses++;
+
+        // Load outside the lock so other workers keep serving hits
+        auto entry = std::make_shared<CachedFile>();
+        entry->filepath = filepath;
+        entry->size = size;
+        entry->mtime = mtime;
+        entry->data.resize(static_cast<size_t>(size));
+        std::ifstream in(filepath, std::ios::binary);
+        in.read(entry->data.data(), size);
+        if (!in || in.gcount() != size)
+            return nullptr;
+        uint32_t fileCrc = crc32Update(0xFFFFFFFFu, entry->data.data(), entry->data.size());
+        entry->header = buildTransferHeader(file.name, size, fileCrc, hashMemoryBlocks(entry->data.data(), size));
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (entry->footprint() > budgetBytes)
+            return entry; // serve it once, but don't cache
+        auto it = index.find(filepath);
+        if (it != index.end())
+            remove(it);
+        evictTo(budgetBytes - entry->footprint());
+        lru.push_front(entry);
+        index[filepath] = lru.begin();
+        usedBytes += entry->footprint();
+        return entry;
     }
-    return true;
+
+    void printStats()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (budgetBytes == 0)
+            return;
+        long long h = hits, m = misses;
+        std::cout << "Cache: " << h << " hits, " << m << " misses ("
+                  << (h + m ? (100 * h) / (h + m) : 0) << "% hit rate), " << oversized << " too large to cache, "
+                  << lru.size() << " files, " << usedBytes << "/" << budgetBytes << " bytes\n";
+    }
+
+private:
+    void remove(std::unordered_map<std::string, std::list<std::shared_ptr<const CachedFile>>::iterator>::iterator it)
+    {
+        usedBytes -= (*it->second)->footprint();
+        lru.erase(it->second);
+        index.erase(it);
+    }
+
+    void evictTo(size_t limit)
+    {
+        while (usedBytes > limit && !lru.empty())
+            remove(index.find(lru.back()->filepath));
+    }
+};
+
+FileCache fileCache;
+
+// TLS is on when TRANSFER_TLS=1; every connection then handshakes with these credentials
+bool tlsEnabled = false;
+CredHandle serverCredentials;
+
+// Create the sender's self-signed certificate in the user's MY store, with its RSA key
+// persisted by the key storage provider so the fingerprint listeners pin survives restarts
+PCCERT_CONTEXT createServerCertificate(HCERTSTORE store)
+{
+    NCRYPT_PROV_HANDLE provider = 0;
+    NCRYPT_KEY_HANDLE key = 0;
+    DWORD keyBits = 2048;
+    if (NCryptOpenStorageProvider(&provider, MS_KEY_STORAGE_PROVIDER, 0) != ERROR_SUCCESS)
+    {
+        std::cerr << "Cannot open the key storage provider\n";
+        return NULL;
+    }
+    if (NCryptCreatePersistedKey(provider, &key, BCRYPT_RSA_ALGORITHM, L"" TLS_CERT_SUBJECT, 0, NCRYPT_OVERWRITE_KEY_FLAG) != ERROR_SUCCESS ||
+        NCryptSetProperty(key, NCRYPT_LENGTH_PROPERTY, (PBYTE)&keyBits, sizeof(keyBits), 0) != ERROR_SUCCESS ||
+        NCryptFinalizeKey(key, 0) != ERROR_SUCCESS)
+    {
+        std::cerr << "Cannot create the TLS certificate key\n";
+        if (key)
+            NCryptFreeObject(key);
+        NCryptFreeObject(provider);
+        return NULL;
+    }
+
+    BYTE nameBuf[256];
+    CERT_NAME_BLOB name = {sizeof(nameBuf), nameBuf};
+    PCCERT_CONTEXT cert = NULL;
+    if (CertStrToNameA(X509_ASN_ENCODING, "CN=" TLS_CERT_SUBJECT, CERT_X500_NAME_STR, NULL, nameBuf, &name.cbData, NULL))
+    {
+        SYSTEMTIME expiry;
+        GetSystemTime(&expiry);
+        expiry.wYear += TLS_CERT_YEARS;
+        if (expiry.wMonth == 2 && expiry.wDay == 29)
+            expiry.wDay = 28;
+        // The key provider info becomes a certificate property, so Schannel finds the key again
+        // when a later run loads the certificate from the store
+        CRYPT_KEY_PROV_INFO keyInfo = {};
+        keyInfo.pwszContainerName = (LPWSTR)L"" TLS_CERT_SUBJECT;
+        keyInfo.pwszProvName = (LPWSTR)MS_KEY_STORAGE_PROVIDER;
+        CRYPT_ALGORITHM_IDENTIFIER signature = {};
+        signature.pszObjId = (LPSTR)szOID_RSA_SHA256RSA;
+        cert = CertCreateSelfSignCertificate(key, &name, 0, &keyInfo, &signature, NULL, &expiry, NULL);
+    }
+    PCCERT_CONTEXT stored = NULL;
+    if (!cert || !CertAddCertificateContextToStore(store, cert, CERT_STORE_ADD_REPLACE_EXISTING, &stored))
+        std::cerr << "Cannot create the TLS certificate: " << GetLastError() << "\n";
+    if (cert)
+        CertFreeCertificateContext(cert);
+    NCryptFreeObject(key);
+    NCryptFreeObject(provider);
+    return stored;
 }
 
-// Helper: receive exactly len bytes into buf
-bool recvExactBytes(SOCKET sock, char *buf, int len)
+// The sender's certificate: reuse a valid one from an earlier run, else create it
+PCCERT_CONTEXT loadServerCertificate()
 {
-    int total = 0;
-    while (total < len)
+    HCERTSTORE store = CertOpenStore(CERT_STORE_PROV_SYSTEM_A, 0, 0, CERT_SYSTEM_STORE_CURRENT_USER, "MY");
+    if (!store)
     {
-        int recvd = recv(sock, buf + total, len - total, 0);
-        if (recvd <= 0)
-        {
-            std::cerr << "Recv error or connection closed: " << WSAGetLastError() << "\n";
-            return false;
-        }
-        total += recvd;
+        std::cerr << "Cannot open the certificate store: " << GetLastError() << "\n";
+        return NULL;
     }
-    return true;
+    PCCERT_CONTEXT cert = NULL;
+    while ((cert = CertFindCertificateInStore(store, X509_ASN_ENCODING, 0, CERT_FIND_SUBJECT_STR_A,
+                                              TLS_CERT_SUBJECT, cert)) != NULL)
+    {
+        DWORD keyInfoLen = 0;
+        if (CertVerifyTimeValidity(NULL, cert->pCertInfo) == 0 &&
+            CertGetCertificateContextProperty(cert, CERT_KEY_PROV_INFO_PROP_ID, NULL, &keyInfoLen))
+            break;
+    }
+    if (!cert)
+        cert = createServerCertificate(store);
+    CertCloseStore(store, 0);
+    return cert;
 }
 
 // Send file using length-prefixed protocol
-// Format: [4-byte filename_len][filename][8-byte file_size][file_data]
-bool sendFile(SOCKET sock, const std::string &filename, const std::string &filepath)
+// Format: [header from buildTransferHeader][file_data]
+// Then repair rounds: receiver replies [4-byte bad_count][bad_count x 4-byte block index],
+// sender re-sends those blocks in order, until bad_count is 0 (done) or REPAIR_ABORT.
+bool sendFile(SOCKET sock, const CatalogEntry &file)
 {
+    const std::string &filename = file.name;
+    const std::string &filepath = file.fullPath;
+
+    // Cache hit: header and data go out in a single gather send, straight from memory
+    std::shared_ptr<const CachedFile> cached = fileCache.acquire(file);
+    if (cached)
+    {
+        std::cout << "Sending file: " << filename << " (" << cached->size << " bytes, cached)\n";
+        auto transferStart = std::chrono::steady_clock::now();
+        WSABUF bufs[2];
+        bufs[0].buf = const_cast<char *>(cached->header.data());
+        bufs[0].len = static_cast<unsigned long>(cached->header.size());
+        bufs[1].buf = const_cast<char *>(cached->data.data());
+        bufs[1].len = static_cast<unsigned long>(cached->data.size());
+        if (!sendGather(sock, bufs, 2))
+            return false;
+        if (!serveBlockRepairs(sock, filename, cached->size, [&](long long offset, int)
+                               { return cached->data.data() + offset; }))
+            return false;
+        fileCache.printStats();
+        logThroughput("Sent " + filename, cached->size, transferStart);
+        std::cout << "File sent successfully.\n";
+        return true;
+    }
+
     std::ifstream infile(filepath, std::ios::binary);
     if (!infile)
     {
@@ -80,99 +1223,396 @@ bool sendFile(SOCKET sock, const std::string &filename, const std::string &filep
     infile.seekg(0, std::ios::beg);
 
     std::cout << "Sending file: " << filename << " (" << fileSize << " bytes)\n";
+    auto transferStart = std::chrono::steady_clock::now();
 
-    // Send filename length (4 bytes, little-endian)
-    int fnLen = static_cast<int>(filename.size());
-    char lenBuf[4];
-    lenBuf[0] = (fnLen >> 0) & 0xFF;
-    lenBuf[1] = (fnLen >> 8) & 0xFF;
-    lenBuf[2] = (fnLen >> 16) & 0xFF;
-    lenBuf[3] = (fnLen >> 24) & 0xFF;
-    if (!sendAllBytes(sock, lenBuf, 4))
+    // One pass over the file yields both the CRC and the integrity block hashes
+    uint32_t runningCrc = 0xFFFFFFFFu;
+    std::vector<uint64_t> blockHashes;
+    if (!scanFileBlocks(infile, fileSize, runningCrc, blockHashes))
+    {
+        std::cerr << "Failed to hash file blocks: " << filepath << "\n";
+        return false;
+    }
+    ConnectionTuner tuner(sock, true);
+    if (!tuner.probeRtt())
+        return false;
+    std::vector<char> header = buildTransferHeader(filename, fileSize, runningCrc, blockHashes);
+    if (!sendAllBytes(sock, header.data(), static_cast<int>(header.size())))
         return false;
 
-    // Send filename
-    if (!sendAllBytes(sock, filename.c_str(), fnLen))
+    // Rewind file back to start and send file data in chunks sized by the connection tuner
+    infile.clear();
+    infile.seekg(0, std::ios::beg);
+
+    std::vector<char> chunk(MAX_CHUNK_SIZE);
+    long long sent = 0;
+    while (sent < fileSize)
+    {
+        int toRead = (fileSize - sent > tuner.chunkSize) ? tuner.chunkSize : static_cast<int>(fileSize - sent);
+        infile.read(chunk.data(), toRead);
+        if (!sendAllBytes(sock, chunk.data(), toRead) || receiverAborted(sock, filename))
+            return false;
+        sent += toRead;
+        tuner.onProgress(sent);
+    }
+
+    std::vector<char> block(BLOCK_SIZE);
+    bool repaired = serveBlockRepairs(sock, filename, fileSize, [&](long long offset, int len) -> const char *
+                                      {
+        infile.clear();
+        infile.seekg(offset, std::ios::beg);
+        infile.read(block.data(), len);
+        return infile.gcount() == len ? block.data() : nullptr; });
+    if (!repaired)
         return false;
 
-    // Send file size (8 bytes, little-endian)
-    char sizeBuf[8];
-    for (int i = 0; i < 8; i++)
-        sizeBuf[i] = (fileSize >> (i * 8)) & 0xFF;
-    if (!sendAllBytes(sock, sizeBuf, 8))
+    infile.close();
+    fileCache.printStats();
+    logThroughput("Sent " + filename, fileSize, transferStart);
+    std::cout << "File sent successfully.\n";
+    return true;
+}
+
+// Read a listener's file request and serve it from the catalog
+// Request format: [4-byte request_len][request] (empty = DEFAULT_FILE, "#<id>" = catalog ID)
+// Unknown files are answered with NOT_FOUND in place of filename_len.
+bool serveFileRequest(SOCKET sock)
+{
+    char lenBuf[4];
+    if (!recvExactBytes(sock, lenBuf, 4))
+        return false;
+    uint32_t reqLen = getLe32(lenBuf);
+    if (reqLen > MAX_REQUEST_LEN)
+    {
+        std::cerr << "File request too long (" << reqLen << " bytes)\n";
+        return false;
+    }
+    std::string request(reqLen, '\0');
+    if (reqLen > 0 && !recvExactBytes(sock, &request[0], static_cast<int>(reqLen)))
         return false;
 
-    // Compute CRC32 for the file (so receiver can verify integrity)
-    // CRC32 polynomial 0xEDB88320
-    static uint32_t crc_table[256];
-    static bool crc_table_init = false;
-    if (!crc_table_init)
+    std::shared_ptr<const CatalogEntry> file = catalog.lookup(request);
+    if (!file)
     {
-        for (uint32_t i = 0; i < 256; ++i)
+        std::cerr << "Requested file not in catalog: " << (request.empty() ? DEFAULT_FILE : request) << "\n";
+        char notFound[4];
+        putLe32(notFound, NOT_FOUND);
+        sendAllBytes(sock, notFound, 4);
+        return false;
+    }
+    return sendFile(sock, *file);
+}
+
+struct DiskWriter;
+
+// One upload in flight: data goes to tempPath, which is renamed to finalPath once durable
+struct UploadFile
+{
+    std::string tempPath;
+    std::string finalPath;
+    std::string stem, ext;           // output name parts, to pick another name if finalPath gets taken
+    FILE *fp = nullptr;
+    DiskWriter *writer = nullptr;
+    std::atomic<bool> failed{false}; // write failed or upload aborted; remaining writes are skipped
+    bool done = false;               // commit or abort has been processed
+    bool committed = false;          // file is fsync'd and renamed into place
+    bool nameTaken = false;          // durable, but a file appeared at finalPath; tempPath is kept
+
+    // Rename tempPath into place without replacing anything already there. On failure the temp
+    // file is deleted, unless the name was taken, in which case the caller can try another name.
+    bool publish()
+    {
+        if (MoveFileExA(tempPath.c_str(), finalPath.c_str(), MOVEFILE_WRITE_THROUGH))
         {
-            uint32_t c = i;
-            for (int j = 0; j < 8; ++j)
-                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : (c >> 1);
-            crc_table[i] = c;
+            committed = true;
+            return true;
         }
-        crc_table_init = true;
+        DWORD err = GetLastError();
+        nameTaken = err == ERROR_ALREADY_EXISTS || err == ERROR_FILE_EXISTS;
+        if (!nameTaken)
+            std::remove(tempPath.c_str());
+        return false;
     }
+};
 
-    auto crc32_update = [&](uint32_t crc, const char *buf, size_t len) -> uint32_t
+// Background writer for one device. Receive threads queue chunks and go straight back to the
+// socket. A second thread fsyncs and renames finished files in batches (group commit), so a
+// flush never holds up the writes of other uploads on the same volume.
+struct DiskWriter
+{
+    enum class OpKind
+    {
+        Write,
+        Commit,
+        Abort
+    };
+    struct Op
     {
-        uint32_t c = crc ^ 0xFFFFFFFFu;
-        for (size_t k = 0; k < len; ++k)
-            c = crc_table[(c ^ (unsigned char)buf[k]) & 0xFFu] ^ (c >> 8);
-        return c ^ 0xFFFFFFFFu;
+        OpKind kind;
+        std::shared_ptr<UploadFile> file;
+        std::vector<char> data;
     };
 
-    // Read through file to compute CRC
-    uint32_t runningCrc = 0xFFFFFFFFu;
-    infile.clear();
-    infile.seekg(0, std::ios::beg);
-    char crcChunk[CHUNK_SIZE];
-    long long scanned = 0;
-    while (scanned < fileSize)
-    {
-        int toRead = (fileSize - scanned > CHUNK_SIZE) ? CHUNK_SIZE : static_cast<int>(fileSize - scanned);
-        infile.read(crcChunk, toRead);
-        std::streamsize r = infile.gcount();
-        if (r <= 0)
-            break;
-        runningCrc = crc32_update(runningCrc, crcChunk, static_cast<size_t>(r));
-        scanned += r;
-    }
-    uint32_t fileCrc = runningCrc;
-
-    // Send CRC32 (4 bytes, little-endian)
-    char crcBuf[4];
-    crcBuf[0] = (fileCrc >> 0) & 0xFF;
-    crcBuf[1] = (fileCrc >> 8) & 0xFF;
-    crcBuf[2] = (fileCrc >> 16) & 0xFF;
-    crcBuf[3] = (fileCrc >> 24) & 0xFF;
-    if (!sendAllBytes(sock, crcBuf, 4))
-        return false;
+    std::deque<Op> queue;
+    size_t queuedBytes = 0;
+    std::vector<std::shared_ptr<UploadFile>> finished; // fully written, waiting for flush + rename
+    bool stopping = false;
+    bool writerStopped = false;
+    std::mutex mutex;
+    std::condition_variable workCV;   // writer waits for ops
+    std::condition_variable commitCV; // committer waits for finished files
+    std::condition_variable spaceCV;  // receivers wait for the backlog to drain
+    std::condition_variable doneCV;   // receivers wait for their commit
+    std::thread thread;               // last members: start once the rest is constructed
+    std::thread committer;
 
-    // Rewind file back to start and send file data in chunks
-    infile.clear();
-    infile.seekg(0, std::ios::beg);
+    DiskWriter() : thread(&DiskWriter::run, this), committer(&DiskWriter::runCommits, this) {}
 
-    // Send file data in chunks
-    char chunk[CHUNK_SIZE];
-    long long sent = 0;
-    while (sent < fileSize)
+    ~DiskWriter()
     {
-        int toRead = (fileSize - sent > CHUNK_SIZE) ? CHUNK_SIZE : static_cast<int>(fileSize - sent);
-        infile.read(chunk, toRead);
-        if (!sendAllBytes(sock, chunk, toRead))
-            return false;
-        sent += toRead;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        workCV.notify_all();
+        thread.join();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            writerStopped = true;
+        }
+        commitCV.notify_all();
+        committer.join();
     }
 
-    infile.close();
-    std::cout << "File sent successfully.\n";
-    return true;
-}
+    // Queue a chunk for writing, blocking while MAX_WRITE_BACKLOG bytes are already pending
+    void write(const std::shared_ptr<UploadFile> &file, std::vector<char> &&data)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        spaceCV.wait(lock, [&]
+                     { return queuedBytes < MAX_WRITE_BACKLOG; });
+        queuedBytes += data.size();
+        queue.push_back(Op{OpKind::Write, file, std::move(data)});
+        lock.unlock();
+        workCV.notify_one();
+    }
+
+    // Make the file durable and move it into place; blocks until its group commit finishes
+    bool commit(const std::shared_ptr<UploadFile> &file)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        queue.push_back(Op{OpKind::Commit, file, {}});
+        workCV.notify_one();
+        doneCV.wait(lock, [&]
+                    { return file->done; });
+        return file->committed;
+    }
+
+    // Discard a partial upload; its queued writes are skipped rather than written
+    void abort(const std::shared_ptr<UploadFile> &file)
+    {
+        file->failed = true;
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(Op{OpKind::Abort, file, {}});
+        workCV.notify_one();
+    }
+
+private:
+    // Writer thread: apply queued writes in order, pass finished files on to the committer
+    void run()
+    {
+        while (true)
+        {
+            std::deque<Op> batch;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                workCV.wait(lock, [&]
+                            { return !queue.empty() || stopping; });
+                if (queue.empty())
+                    return;
+                batch.swap(queue);
+            }
+
+            std::vector<std::shared_ptr<UploadFile>> batchFinished;
+            for (Op &op : batch)
+            {
+                UploadFile &f = *op.file;
+                if (op.kind == OpKind::Write)
+                {
+                    if (!f.failed && fwrite(op.data.data(), 1, op.data.size(), f.fp) != op.data.size())
+                    {
+                        std::cerr << "Write failed: " << f.tempPath << "\n";
+                        f.failed = true;
+                    }
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        queuedBytes -= op.data.size();
+                    }
+                    spaceCV.notify_all();
+                }
+                else
+                    batchFinished.push_back(op.file); // every write for it is already done
+            }
+            if (batchFinished.empty())
+                continue;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                finished.insert(finished.end(), batchFinished.begin(), batchFinished.end());
+            }
+            commitCV.notify_one();
+        }
+    }
+
+    // Commit thread: flush every file finished since the last group back to back, then publish them
+    void runCommits()
+    {
+        while (true)
+        {
+            std::vector<std::shared_ptr<UploadFile>> group;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                commitCV.wait(lock, [&]
+                              { return !finished.empty() || writerStopped; });
+                if (finished.empty())
+                    return;
+                group.swap(finished);
+            }
+
+            for (auto &file : group)
+            {
+                UploadFile &f = *file;
+                if (!f.failed && (fflush(f.fp) != 0 || _commit(_fileno(f.fp)) != 0))
+                {
+                    std::cerr << "Flush failed: " << f.tempPath << "\n";
+                    f.failed = true;
+                }
+                fclose(f.fp);
+                f.fp = nullptr;
+            }
+            int committed = 0;
+            for (auto &file : group)
+            {
+                UploadFile &f = *file;
+                if (f.failed)
+                    std::remove(f.tempPath.c_str());
+                else if (f.publish())
+                    committed++;
+            }
+            if (committed > 1)
+                std::cout << "Group commit: " << committed << " files\n";
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (auto &file : group)
+                    file->done = true;
+            }
+            doneCV.notify_all();
+        }
+    }
+};
+
+// Where uploads land: one DiskWriter per volume, and a reservation per in-flight output name
+// so two clients uploading the same filename get distinct outputs. Names already on disk are
+// skipped too, and the final rename never replaces a file, so no upload overwrites another.
+struct UploadStore
+{
+    std::string dir = DEFAULT_UPLOAD_DIR;
+    std::unordered_set<std::string> reserved; // final paths of uploads in flight
+    std::unordered_map<std::string, std::unique_ptr<DiskWriter>> writers;
+    std::atomic<unsigned long long> nextTempId{0};
+    std::mutex mutex;
+
+    // Reserve an output name ("<name>_copy<ext>", then "<name>_copy(2)<ext>", ...) and open its temp file
+    std::shared_ptr<UploadFile> begin(const std::string &filename)
+    {
+        // Keep only the last path component so uploads can't escape dir
+        size_t sep = filename.find_last_of("/\\:");
+        std::string leaf = (sep == std::string::npos) ? filename : filename.substr(sep + 1);
+        if (leaf.empty() || leaf == "." || leaf == "..")
+            leaf = "upload";
+        std::string stem = leaf, ext;
+        size_t dot = leaf.find_last_of('.');
+        if (dot != std::string::npos)
+        {
+            stem = leaf.substr(0, dot);
+            ext = leaf.substr(dot);
+        }
+
+        auto file = std::make_shared<UploadFile>();
+        file->stem = stem;
+        file->ext = ext;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            file->finalPath = reserveName(stem, ext);
+            file->writer = &writerFor(file->finalPath);
+        }
+        file->tempPath = file->finalPath + ".part" + std::to_string(nextTempId++);
+        file->fp = fopen(file->tempPath.c_str(), "wb");
+        if (!file->fp)
+        {
+            release(*file);
+            return nullptr;
+        }
+        return file;
+    }
+
+    bool commit(const std::shared_ptr<UploadFile> &file)
+    {
+        bool ok = file->writer->commit(file);
+        // Something created the reserved name after begin() checked it: move on to the next free one
+        while (!ok && file->nameTaken)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                reserved.erase(file->finalPath);
+                file->finalPath = reserveName(file->stem, file->ext);
+            }
+            ok = file->publish();
+        }
+        release(*file);
+        return ok;
+    }
+
+    void abort(const std::shared_ptr<UploadFile> &file)
+    {
+        file->writer->abort(file); // temp name is unique, so the name can be reused right away
+        release(*file);
+    }
+
+private:
+    // First output name neither reserved by an upload in flight nor present on disk; caller holds mutex
+    std::string reserveName(const std::string &stem, const std::string &ext)
+    {
+        for (int n = 1;; ++n)
+        {
+            std::string candidate = dir + "/" + stem + "_copy" + (n > 1 ? "(" + std::to_string(n) + ")" : "") + ext;
+            if (!reserved.count(candidate) && GetFileAttributesA(candidate.c_str()) == INVALID_FILE_ATTRIBUTES)
+            {
+                reserved.insert(candidate);
+                return candidate;
+            }
+        }
+    }
+
+    void release(const UploadFile &file)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        reserved.erase(file.finalPath);
+    }
+
+    // Uploads on the same volume share a writer; caller holds mutex
+    DiskWriter &writerFor(const std::string &path)
+    {
+        char volume[MAX_PATH];
+        std::string key = GetVolumePathNameA(path.c_str(), volume, MAX_PATH) ? volume : "";
+        std::unique_ptr<DiskWriter> &writer = writers[key];
+        if (!writer)
+            writer.reset(new DiskWriter());
+        return *writer;
+    }
+};
+
+UploadStore uploads;
 
 // Receive file using length-prefixed protocol
 // Format: [4-byte filename_len][filename][8-byte file_size][file_data]
@@ -180,10 +1620,15 @@ bool receiveFile(SOCKET sock)
 {
     // Receive filename length
     char lenBuf[4];
-    if (!recvExactBytes(sock, lenBuf, 4))
+    if (!recvHeaderLength(sock, lenBuf))
         return false;
     int fnLen = (lenBuf[0] & 0xFF) | ((lenBuf[1] & 0xFF) << 8) |
                 ((lenBuf[2] & 0xFF) << 16) | ((lenBuf[3] & 0xFF) << 24);
+    if (fnLen <= 0 || fnLen > MAX_REQUEST_LEN)
+    {
+        std::cerr << "Invalid filename length: " << fnLen << "\n";
+        return false;
+    }
 
     // Receive filename
     std::string filename(fnLen, '\0');
@@ -199,39 +1644,39 @@ bool receiveFile(SOCKET sock)
         fileSize |= ((long long)(sizeBuf[i] & 0xFF)) << (i * 8);
 
     std::cout << "Receiving file: " << filename << " (" << fileSize << " bytes)\n";
+    auto transferStart = std::chrono::steady_clock::now();
 
-    // Generate output filename with _copy suffix
-    std::string outFilename;
-    size_t dot = filename.find_last_of('.');
-    if (dot == std::string::npos)
-        outFilename = filename + "_copy";
-    else
-        outFilename = filename.substr(0, dot) + "_copy" + filename.substr(dot);
-
-    // Receive file data and write to disk
-    std::ofstream outfile(outFilename, std::ios::binary);
-    if (!outfile)
+    // Writes go to a temp file through the volume's writer thread
+    std::shared_ptr<UploadFile> upload = uploads.begin(filename);
+    if (!upload)
     {
-        std::cerr << "Cannot create output file: " << outFilename << "\n";
+        std::cerr << "Cannot create output file for: " << filename << "\n";
         return false;
     }
 
-    char chunk[CHUNK_SIZE];
+    ConnectionTuner tuner(sock, false);
     long long recvd = 0;
     while (recvd < fileSize)
     {
-        int toRecv = (fileSize - recvd > CHUNK_SIZE) ? CHUNK_SIZE : static_cast<int>(fileSize - recvd);
-        if (!recvExactBytes(sock, chunk, toRecv))
+        int toRecv = (fileSize - recvd > tuner.chunkSize) ? tuner.chunkSize : static_cast<int>(fileSize - recvd);
+        std::vector<char> chunk(toRecv);
+        if (!recvExactBytes(sock, chunk.data(), toRecv))
         {
-            outfile.close();
+            uploads.abort(upload);
             return false;
         }
-        outfile.write(chunk, toRecv);
+        upload->writer->write(upload, std::move(chunk));
         recvd += toRecv;
+        tuner.onProgress(recvd);
     }
 
-    outfile.close();
-    std::cout << "File received and saved: " << outFilename << "\n";
+    if (!uploads.commit(upload))
+    {
+        std::cerr << "Failed to save file: " << upload->finalPath << "\n";
+        return false;
+    }
+    logThroughput("Received " + filename, fileSize, transferStart);
+    std::cout << "File received and saved: " << upload->finalPath << "\n";
     return true;
 }
 
@@ -292,20 +1737,7 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    // Read file to send (default: data.txt)
-    const std::string filename = "data.txt";
-    std::string filepath = filename;
-
-    std::ifstream file(filepath, std::ios::binary);
-    if (!file)
-    {
-        std::cerr << "Error: Could not read " << filepath << "\n";
-        WSACleanup();
-        return 1;
-    }
-    file.close();
-
-    // Allow optional port argument: sender.exe [base_port]
+    // Allow optional arguments: sender.exe [base_port] [cache_mb] [root_dir] [upload_dir]
     // base_port + 0 = receive port, base_port + 1 = send port
     int basePort = PORT_RECEIVE;
     if (argc >= 2)
@@ -315,12 +1747,83 @@ int main(int argc, char *argv[])
             basePort = p;
     }
 
+    long long cacheMb = DEFAULT_CACHE_MB;
+    if (argc >= 3)
+    {
+        long long mb = atoll(argv[2]);
+        if (mb >= 0)
+            cacheMb = mb;
+    }
+    fileCache.configure(static_cast<size_t>(cacheMb) * 1024 * 1024);
+
     int receivePort = basePort;
     int sendPort = basePort + 1;
 
     std::cout << "Sender: Starting dual-port server...\n";
     std::cout << "  Receive port (listeners send files here): " << receivePort << "\n";
     std::cout << "  Send port (listeners receive files from here): " << sendPort << "\n";
+    std::cout << "  File cache budget: " << cacheMb << " MB\n";
+
+    // Uploads land in their own directory, which the catalog never serves
+    if (argc >= 5)
+        uploads.dir = argv[4];
+    if (!CreateDirectoryA(uploads.dir.c_str(), NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+        std::cerr << "Warning: cannot create upload directory " << uploads.dir << "\n";
+    std::cout << "Uploads saved under: " << uploads.dir << "\n";
+
+    // Index the served directory once up front; requests are then pure lookups
+    std::string rootDir = (argc >= 4) ? argv[3] : ".";
+    std::string rootKey = Catalog::pathKey(Catalog::fullPathOf(rootDir));
+    std::string uploadKey = Catalog::pathKey(Catalog::fullPathOf(uploads.dir));
+    if (rootKey == uploadKey || rootKey.compare(0, uploadKey.size() + 1, uploadKey + "/") == 0)
+    {
+        std::cerr << "upload_dir must not be root_dir or contain it: uploads would be served while still being written\n";
+        WSACleanup();
+        return 1;
+    }
+    catalog.excludedDir = uploads.dir;
+    auto scanStart = std::chrono::steady_clock::now();
+    size_t fileCount = catalog.load(rootDir);
+    long long scanMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                           std::chrono::steady_clock::now() - scanStart)
+                           .count();
+    std::cout << "Catalog: " << fileCount << " files indexed under " << rootDir << " in " << scanMs << " ms\n";
+    if (!catalog.lookup(""))
+        std::cerr << "Warning: default file " << DEFAULT_FILE << " is not in the catalog\n";
+    std::thread(&Catalog::watch, &catalog).detach();
+
+    const char *tune = getenv("TRANSFER_TUNE");
+    tuningEnabled = !(tune && strcmp(tune, "0") == 0);
+    std::cout << "Connection tuning: " << (tuningEnabled ? "adaptive" : "off (TRANSFER_TUNE=0)") << "\n";
+
+    // TRANSFER_KEY selected the old pre-shared-key channel; TLS replaced it. Refuse rather than
+    // silently serve in the clear.
+    if (getenv("TRANSFER_KEY"))
+    {
+        std::cerr << "TRANSFER_KEY is no longer supported; set TRANSFER_TLS=1 and give listeners the printed TRANSFER_TLS_PIN\n";
+        WSACleanup();
+        return 1;
+    }
+    const char *tls = getenv("TRANSFER_TLS");
+    tlsEnabled = tls && strcmp(tls, "1") == 0;
+    if (tlsEnabled)
+    {
+        PCCERT_CONTEXT cert = loadServerCertificate();
+        std::string fingerprint = cert ? certFingerprint(cert) : "";
+        if (fingerprint.empty() || !acquireTlsCredentials(cert, serverCredentials))
+        {
+            std::cerr << "TLS is unavailable; not starting\n";
+            if (cert)
+                CertFreeCertificateContext(cert);
+            WSACleanup();
+            return 1;
+        }
+        CertFreeCertificateContext(cert);
+        std::cout << "Transport: TLS (certificate CN=" << TLS_CERT_SUBJECT << ")\n";
+        std::cout << "Listeners connect with: TRANSFER_TLS_PIN=" << fingerprint << "\n";
+    }
+    else
+        std::cout << "Transport: plaintext (TRANSFER_TLS=1 enables TLS)\n";
 
     // Print local IP addresses for convenience
     char hostname[256];
@@ -409,16 +1912,25 @@ int main(int argc, char *argv[])
                       << " (Active threads: " << activeThreads << ", Queue size: " << taskQueue.size() << ")\n";
 
             // Submit task to thread pool instead of spawning detached thread
-            submitTask([clientSock, filename, filepath, isSendMode, port]()
+            submitTask([clientSock, isSendMode, port]()
                        {
                 try
                 {
+                    // TLS mode: every byte after the handshake goes through the channel
+                    TlsChannel channel;
+                    if (tlsEnabled && !channel.accept(clientSock, serverCredentials))
+                    {
+                        std::cerr << "TLS handshake failed on port " << port << "\n";
+                        closesocket(clientSock);
+                        return;
+                    }
+                    activeChannel = tlsEnabled ? &channel : nullptr;
+
                     if (isSendMode)
                     {
-                        // Send-only: send file to client
+                        // Send-only: send the requested file to client
                         std::cout << "Sending file on port " << port << "...\n";
-                        std::this_thread::sleep_for(std::chrono::milliseconds(100)); // Give client time to be ready
-                        if (!sendFile(clientSock, filename, filepath))
+                        if (!serveFileRequest(clientSock))
                             std::cerr << "Failed to send file on port " << port << "\n";
                         else
                             std::cout << "File sent successfully on port " << port << "\n";
@@ -432,10 +1944,12 @@ int main(int argc, char *argv[])
                         else
                             std::cout << "File received successfully on port " << port << "\n";
                     }
+                    activeChannel = nullptr;
                     closesocket(clientSock);
                 }
                 catch (const std::exception &e)
                 {
+                    activeChannel = nullptr;
                     std::cerr << "Exception on port " << port << ": " << e.what() << "\n";
                     closesocket(clientSock);
                 } });
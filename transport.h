@@ -0,0 +1,430 @@
+// Connection I/O shared by sender.cpp and listener.cpp: raw socket helpers and the optional
+// TLS channel (Windows Schannel) that every byte of a transfer goes through when it is on.
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cctype>
+#include <winsock2.h>
+#ifndef SECURITY_WIN32
+#define SECURITY_WIN32
+#endif
+#include <security.h>
+#include <schannel.h>
+#include <wincrypt.h>
+#include <bcrypt.h>
+
+#pragma comment(lib, "ws2_32.lib")
+#pragma comment(lib, "secur32.lib") // Schannel
+#pragma comment(lib, "crypt32.lib") // certificates
+#pragma comment(lib, "bcrypt.lib")  // certificate fingerprints
+
+#define TLS_SEND_RECORDS 16     // Records encrypted back to back before one send() call
+#define TLS_RECV_BUFFER 131072  // Ciphertext receive buffer; holds several full-size records
+
+// Helper: send all bytes from buf, bypassing any TLS channel
+inline bool sendRawBytes(SOCKET sock, const char *buf, int len)
+{
+    int total = 0;
+    while (total < len)
+    {
+        int sent = send(sock, buf + total, len - total, 0);
+        if (sent == SOCKET_ERROR)
+        {
+            int err = WSAGetLastError();
+            std::cerr << "Send error: " << err << " (WSAECONNRESET=" << WSAECONNRESET
+                      << ", WSAECONNABORTED=" << WSAECONNABORTED << ")\n";
+            return false;
+        }
+        if (sent == 0)
+        {
+            std::cerr << "Send returned 0 (connection closed by remote)\n";
+            return false;
+        }
+        total += sent;
+    }
+    return true;
+}
+
+// Helper: receive exactly len bytes into buf, bypassing any TLS channel
+inline bool recvRawBytes(SOCKET sock, char *buf, int len)
+{
+    int total = 0;
+    while (total < len)
+    {
+        int recvd = recv(sock, buf + total, len - total, 0);
+        if (recvd <= 0)
+        {
+            std::cerr << "Recv error or connection closed: " << WSAGetLastError() << "\n";
+            return false;
+        }
+        total += recvd;
+    }
+    return true;
+}
+
+// SHA-256 of a certificate's DER encoding as 64 lowercase hex digits, "" on failure
+inline std::string certFingerprint(PCCERT_CONTEXT cert)
+{
+    static BCRYPT_ALG_HANDLE sha256 = NULL;
+    static std::once_flag opened;
+    std::call_once(opened, []
+                   {
+        if (!BCRYPT_SUCCESS(BCryptOpenAlgorithmProvider(&sha256, BCRYPT_SHA256_ALGORITHM, NULL, 0)))
+            sha256 = NULL; });
+
+    unsigned char hash[32];
+    if (!sha256 || !BCRYPT_SUCCESS(BCryptHash(sha256, NULL, 0, cert->pbCertEncoded, cert->cbCertEncoded, hash, 32)))
+        return "";
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    for (unsigned char b : hash)
+    {
+        hex += digits[b >> 4];
+        hex += digits[b & 0xF];
+    }
+    return hex;
+}
+
+// Normalize a fingerprint given by the user: 64 hex digits, ':' or ' ' separators allowed
+inline bool parseFingerprint(const std::string &text, std::string &fingerprint)
+{
+    fingerprint.clear();
+    for (char c : text)
+    {
+        if (c == ':' || c == ' ')
+            continue;
+        if (!isxdigit(static_cast<unsigned char>(c)))
+            return false;
+        fingerprint += static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    }
+    return fingerprint.size() == 64;
+}
+
+// Schannel credentials for one side: the sender's carry its certificate, the listener's carry
+// none and leave certificate checking to TlsChannel::connect (the sender's is self-signed).
+// TLS 1.2, strong cipher suites only; Windows picks an AES-GCM suite with ECDHE.
+inline bool acquireTlsCredentials(PCCERT_CONTEXT serverCert, CredHandle &cred)
+{
+    SCHANNEL_CRED config;
+    memset(&config, 0, sizeof(config));
+    config.dwVersion = SCHANNEL_CRED_VERSION;
+    config.dwFlags = SCH_USE_STRONG_CRYPTO;
+    if (serverCert)
+    {
+        config.cCreds = 1;
+        config.paCred = &serverCert;
+        config.grbitEnabledProtocols = SP_PROT_TLS1_2_SERVER;
+    }
+    else
+    {
+        config.grbitEnabledProtocols = SP_PROT_TLS1_2_CLIENT;
+        config.dwFlags |= SCH_CRED_MANUAL_CRED_VALIDATION | SCH_CRED_NO_DEFAULT_CREDS;
+    }
+    TimeStamp expiry;
+    SECURITY_STATUS status = AcquireCredentialsHandleA(NULL, (LPSTR)UNISP_NAME_A,
+                                                       serverCert ? SECPKG_CRED_INBOUND : SECPKG_CRED_OUTBOUND,
+                                                       NULL, &config, NULL, NULL, &cred, &expiry);
+    if (status != SEC_E_OK)
+    {
+        std::cerr << "Cannot acquire TLS credentials (0x" << std::hex << status << std::dec << ")\n";
+        return false;
+    }
+    return true;
+}
+
+// TLS over one connection through Schannel. The handshake and record protection are the
+// platform's; this only moves bytes between the socket and Schannel's buffers. Encrypted records
+// are batched into one send(), and records are decrypted in place in the receive buffer.
+struct TlsChannel
+{
+    SOCKET sock = INVALID_SOCKET;
+    CtxtHandle context;
+    bool hasContext = false;
+    SecPkgContext_StreamSizes sizes = {};
+    std::vector<char> sendBuf;  // records staged for one send()
+    std::vector<char> recvBuf;  // ciphertext; [recvPos, recvEnd) is not yet decrypted
+    size_t recvPos = 0;
+    size_t recvEnd = 0;
+    char *plain = nullptr;      // decrypted bytes not yet handed to the caller (inside recvBuf)
+    size_t plainLen = 0;
+
+    ~TlsChannel()
+    {
+        if (hasContext)
+            DeleteSecurityContext(&context);
+    }
+
+    // Listener side: handshake, then accept the sender only if its certificate has the pinned fingerprint
+    bool connect(SOCKET s, CredHandle &cred, const std::string &pinnedFingerprint)
+    {
+        sock = s;
+        if (!handshake(cred, false))
+            return false;
+        PCCERT_CONTEXT cert = NULL;
+        if (QueryContextAttributesA(&context, SECPKG_ATTR_REMOTE_CERT_CONTEXT, &cert) != SEC_E_OK || !cert)
+        {
+            std::cerr << "Sender presented no TLS certificate\n";
+            return false;
+        }
+        std::string fingerprint = certFingerprint(cert);
+        CertFreeCertificateContext(cert);
+        if (fingerprint != pinnedFingerprint)
+        {
+            std::cerr << "Sender certificate fingerprint " << fingerprint << " does not match TRANSFER_TLS_PIN\n";
+            return false;
+        }
+        return true;
+    }
+
+    // Sender side
+    bool accept(SOCKET s, CredHandle &cred)
+    {
+        sock = s;
+        return handshake(cred, true);
+    }
+
+    // Negotiated protocol and cipher strength, for logs
+    std::string describe()
+    {
+        SecPkgContext_ConnectionInfo info;
+        if (QueryContextAttributesA(&context, SECPKG_ATTR_CONNECTION_INFO, &info) != SEC_E_OK)
+            return "TLS";
+        std::string protocol = (info.dwProtocol & SP_PROT_TLS1_2) ? "TLS 1.2" : "TLS";
+        return protocol + ", " + std::to_string(info.dwCipherStrength) + "-bit cipher";
+    }
+
+    bool send(const char *buf, int len)
+    {
+        const size_t recordMax = sizes.cbHeader + sizes.cbMaximumMessage + sizes.cbTrailer;
+        for (int offset = 0; offset < len;)
+        {
+            size_t staged = 0;
+            while (offset < len && sendBuf.size() - staged >= recordMax)
+            {
+                ULONG n = static_cast<ULONG>(std::min<size_t>(len - offset, sizes.cbMaximumMessage));
+                char *record = &sendBuf[staged];
+                memcpy(record + sizes.cbHeader, buf + offset, n);
+                SecBuffer parts[4];
+                parts[0] = {sizes.cbHeader, SECBUFFER_STREAM_HEADER, record};
+                parts[1] = {n, SECBUFFER_DATA, record + sizes.cbHeader};
+                parts[2] = {sizes.cbTrailer, SECBUFFER_STREAM_TRAILER, record + sizes.cbHeader + n};
+                parts[3] = {0, SECBUFFER_EMPTY, NULL};
+                SecBufferDesc desc = {SECBUFFER_VERSION, 4, parts};
+                SECURITY_STATUS status = EncryptMessage(&context, 0, &desc, 0);
+                if (status != SEC_E_OK)
+                {
+                    std::cerr << "TLS encryption failed (0x" << std::hex << status << std::dec << ")\n";
+                    return false;
+                }
+                staged += parts[0].cbBuffer + parts[1].cbBuffer + parts[2].cbBuffer;
+                offset += n;
+            }
+            if (!sendRawBytes(sock, sendBuf.data(), static_cast<int>(staged)))
+                return false;
+        }
+        return true;
+    }
+
+    bool recv(char *buf, int len)
+    {
+        for (int done = 0; done < len;)
+        {
+            if (plainLen == 0 && !readRecord())
+                return false;
+            size_t n = std::min<size_t>(len - done, plainLen);
+            memcpy(buf + done, plain, n);
+            plain += n;
+            plainLen -= n;
+            done += static_cast<int>(n);
+        }
+        return true;
+    }
+
+private:
+    // Append whatever the socket has to recvBuf[recvEnd...]
+    bool readMore()
+    {
+        if (recvEnd == recvBuf.size())
+        {
+            std::cerr << "TLS message larger than the receive buffer\n";
+            return false;
+        }
+        int n = ::recv(sock, &recvBuf[recvEnd], static_cast<int>(recvBuf.size() - recvEnd), 0);
+        if (n <= 0)
+        {
+            std::cerr << "Recv error or connection closed: " << WSAGetLastError() << "\n";
+            return false;
+        }
+        recvEnd += n;
+        return true;
+    }
+
+    // Run InitializeSecurityContext / AcceptSecurityContext until the session is up. Input the
+    // token doesn't consume (SECBUFFER_EXTRA) stays in recvBuf; after the handshake it is the
+    // start of the first record.
+    bool handshake(CredHandle &cred, bool isServer)
+    {
+        recvBuf.resize(TLS_RECV_BUFFER);
+        recvPos = recvEnd = 0;
+        const ULONG flags = isServer ? (ASC_REQ_SEQUENCE_DETECT | ASC_REQ_REPLAY_DETECT | ASC_REQ_CONFIDENTIALITY |
+                                        ASC_REQ_EXTENDED_ERROR | ASC_REQ_ALLOCATE_MEMORY | ASC_REQ_STREAM)
+                                     : (ISC_REQ_SEQUENCE_DETECT | ISC_REQ_REPLAY_DETECT | ISC_REQ_CONFIDENTIALITY |
+                                        ISC_REQ_EXTENDED_ERROR | ISC_REQ_ALLOCATE_MEMORY | ISC_REQ_STREAM |
+                                        ISC_REQ_MANUAL_CRED_VALIDATION);
+        bool needInput = isServer; // the client speaks first
+        while (true)
+        {
+            if (needInput && !readMore())
+                return false;
+
+            SecBuffer in[2];
+            in[0] = {static_cast<ULONG>(recvEnd), SECBUFFER_TOKEN, recvBuf.data()};
+            in[1] = {0, SECBUFFER_EMPTY, NULL};
+            SecBuffer out[1];
+            out[0] = {0, SECBUFFER_TOKEN, NULL};
+            SecBufferDesc inDesc = {SECBUFFER_VERSION, 2, in};
+            SecBufferDesc outDesc = {SECBUFFER_VERSION, 1, out};
+            ULONG attrs = 0;
+            SECURITY_STATUS status;
+            if (isServer)
+                status = AcceptSecurityContext(&cred, hasContext ? &context : NULL, &inDesc, flags, 0,
+                                               hasContext ? NULL : &context, &outDesc, &attrs, NULL);
+            else
+                status = InitializeSecurityContextA(&cred, hasContext ? &context : NULL, NULL, flags, 0, 0,
+                                                    hasContext ? &inDesc : NULL, 0, hasContext ? NULL : &context,
+                                                    &outDesc, &attrs, NULL);
+            if (status == SEC_E_INCOMPLETE_MESSAGE)
+            {
+                needInput = true; // the whole buffer is offered again once more has arrived
+                continue;
+            }
+            if (status == SEC_E_OK || status == SEC_I_CONTINUE_NEEDED)
+                hasContext = true;
+
+            // Send our next flight (or, on failure, the alert explaining it)
+            if (out[0].cbBuffer > 0 && out[0].pvBuffer)
+            {
+                bool sent = sendRawBytes(sock, static_cast<const char *>(out[0].pvBuffer), static_cast<int>(out[0].cbBuffer));
+                FreeContextBuffer(out[0].pvBuffer);
+                if (!sent)
+                    return false;
+            }
+            if (status != SEC_E_OK && status != SEC_I_CONTINUE_NEEDED)
+            {
+                std::cerr << "TLS handshake failed (0x" << std::hex << status << std::dec << ")\n";
+                return false;
+            }
+
+            if (in[1].BufferType == SECBUFFER_EXTRA)
+            {
+                memmove(recvBuf.data(), &recvBuf[recvEnd - in[1].cbBuffer], in[1].cbBuffer);
+                recvEnd = in[1].cbBuffer;
+            }
+            else
+                recvEnd = 0;
+            needInput = recvEnd == 0;
+            if (status == SEC_E_OK)
+                break;
+        }
+
+        if (QueryContextAttributesA(&context, SECPKG_ATTR_STREAM_SIZES, &sizes) != SEC_E_OK)
+        {
+            std::cerr << "Cannot query TLS record sizes\n";
+            return false;
+        }
+        size_t recordMax = sizes.cbHeader + sizes.cbMaximumMessage + sizes.cbTrailer;
+        sendBuf.resize(TLS_SEND_RECORDS * recordMax);
+        if (recvBuf.size() < 2 * recordMax)
+            recvBuf.resize(2 * recordMax);
+        return true;
+    }
+
+    // Decrypt the next record in place; plain/plainLen then point at its data
+    bool readRecord()
+    {
+        while (true)
+        {
+            if (recvEnd > recvPos)
+            {
+                SecBuffer parts[4];
+                parts[0] = {static_cast<ULONG>(recvEnd - recvPos), SECBUFFER_DATA, &recvBuf[recvPos]};
+                parts[1] = parts[2] = parts[3] = {0, SECBUFFER_EMPTY, NULL};
+                SecBufferDesc desc = {SECBUFFER_VERSION, 4, parts};
+                SECURITY_STATUS status = DecryptMessage(&context, &desc, 0, NULL);
+                if (status == SEC_E_OK)
+                {
+                    plain = nullptr;
+                    plainLen = 0;
+                    size_t extra = 0;
+                    for (SecBuffer &part : parts)
+                    {
+                        if (part.BufferType == SECBUFFER_DATA)
+                        {
+                            plain = static_cast<char *>(part.pvBuffer);
+                            plainLen = part.cbBuffer;
+                        }
+                        else if (part.BufferType == SECBUFFER_EXTRA)
+                            extra = part.cbBuffer;
+                    }
+                    recvPos = recvEnd - extra;
+                    if (plainLen > 0)
+                        return true;
+                    continue; // empty record
+                }
+                if (status == SEC_I_CONTEXT_EXPIRED)
+                {
+                    std::cerr << "Peer closed the TLS session\n";
+                    return false;
+                }
+                if (status != SEC_E_INCOMPLETE_MESSAGE)
+                {
+                    std::cerr << "TLS record rejected (0x" << std::hex << status << std::dec << ")\n";
+                    return false;
+                }
+            }
+            // Partial record: slide it to the front and read more behind it
+            if (recvPos > 0)
+            {
+                memmove(recvBuf.data(), &recvBuf[recvPos], recvEnd - recvPos);
+                recvEnd -= recvPos;
+                recvPos = 0;
+            }
+            if (!readMore())
+                return false;
+        }
+    }
+};
+
+// Connection's TLS channel, if any; sendAllBytes/recvExactBytes go through it when set
+thread_local TlsChannel *activeChannel = nullptr;
+
+// Helper: send all bytes from buf
+inline bool sendAllBytes(SOCKET sock, const char *buf, int len)
+{
+    if (activeChannel)
+        return activeChannel->send(buf, len);
+    return sendRawBytes(sock, buf, len);
+}
+
+// Helper: receive exactly len bytes into buf
+inline bool recvExactBytes(SOCKET sock, char *buf, int len)
+{
+    if (activeChannel)
+        return activeChannel->recv(buf, len);
+    return recvRawBytes(sock, buf, len);
+}
+
+// Log how fast a transfer went, so plaintext and TLS runs can be compared
+inline void logThroughput(const std::string &what, long long bytes, std::chrono::steady_clock::time_point start)
+{
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << what << ": " << bytes << " bytes in " << static_cast<long long>(secs * 1000) << " ms ("
+              << (secs > 0 ? bytes / secs / (1024 * 1024) : 0) << " MB/s"
+              << (activeChannel ? ", TLS" : "") << ")\n";
+}
@@ -0,0 +1,448 @@
+#include <iostream>
+#include <string>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <thread>
+#include <cstring>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <memory>
+#include <cstdint>
+#include <cstdlib>
+
+#pragma comment(lib, "ws2_32.lib") // link winsock library
+
+#define PORT_RECEIVE 5050        // Default listen base port (listener connects here as if it were the sender)
+#define PROXY_CHUNK 16384        // Bytes read per recv; each read becomes one delayed "packet"
+#define MAX_QUEUED_BYTES 4194304 // In-flight bytes per direction before the proxy stops reading (caps rate at window/latency)
+#define POLL_MS 50               // How long a socket wait lasts before re-checking for a reset or shutdown
+
+typedef std::chrono::steady_clock Clock;
+
+// Link conditions, applied independently to each direction
+struct LinkConfig
+{
+    int latencyMs = 0;           // one-way delay (RTT adds both directions)
+    int jitterMs = 0;            // extra uniform 0..jitterMs delay per packet
+    long long bandwidthKbps = 0; // 0 = unlimited
+    double stallProb = 0;        // chance per packet of a head-of-line stall (lost/reordered segment)
+    int stallMs = 200;           // how long a stall holds the stream
+    long long resetAfter = 0;    // reset the connection after this many bytes (0 = never)
+    double resetProb = 0;        // chance per packet of resetting the connection
+    unsigned seed = 1;           // RNG seed; each direction of each connection derives its own streams
+    int maxConnections = 0;      // exit after this many connections have finished (0 = run forever)
+};
+
+LinkConfig config;
+std::atomic<int> connectionCounter(0);
+std::atomic<int> finishedConnections(0);
+
+// One direction of a proxied connection: reader queues packets with release times, writer
+// sends them when due, paced by the bandwidth cap
+struct Pipe
+{
+    struct Packet
+    {
+        Clock::time_point release;
+        std::vector<char> data; // empty = end of stream
+    };
+
+    std::deque<Packet> queue;
+    size_t queuedBytes = 0;
+    bool aborted = false;
+    std::mutex mutex;
+    std::condition_variable cv;
+    long long bytes = 0;
+    // Each thread draws from its own stream (reader: jitter/stalls, writer: resets), seeded from
+    // --seed, the port, the connection's ordinal on that port and the direction, so a run's draws
+    // don't depend on thread scheduling and successive connections don't repeat each other
+    std::mt19937 delayRng;
+    std::mt19937 resetRng;
+
+    void seed(unsigned base, int port, unsigned ordinal, int direction)
+    {
+        std::seed_seq delaySeq{base, static_cast<unsigned>(port), ordinal, static_cast<unsigned>(direction), 0u};
+        std::seed_seq resetSeq{base, static_cast<unsigned>(port), ordinal, static_cast<unsigned>(direction), 1u};
+        delayRng.seed(delaySeq);
+        resetRng.seed(resetSeq);
+    }
+};
+
+double uniform(std::mt19937 &rng)
+{
+    return std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+}
+
+// Shared state of one client <-> target connection. Both sockets are non-blocking and every
+// wait on them is bounded by POLL_MS, so no thread can sit in recv/send on a socket another
+// thread is tearing down; handleConnection closes them only after all four threads have exited.
+struct ProxyConnection
+{
+    int id;
+    SOCKET client;
+    SOCKET target;
+    Pipe up;   // client -> target
+    Pipe down; // target -> client
+    std::atomic<long long> forwarded{0};
+    std::atomic<bool> aborting{false};  // abortBoth ran: both ends get RST when closed
+    std::atomic<bool> reset{false};     // ...because --reset-after/--reset-prob injected it
+    std::atomic<bool> peerError{false}; // ...because a send or recv failed on one side
+    std::atomic<bool> stopping{false};  // both writers are done; readers should return
+
+    // Abortive teardown of both ends: SO_LINGER 0 makes the closesocket in handleConnection send
+    // RST. Injected resets and real socket errors are logged and counted apart.
+    void abortBoth(bool injected, int error = 0)
+    {
+        if (aborting.exchange(true))
+            return;
+        if (injected)
+        {
+            reset = true;
+            std::cout << "[conn " << id << "] injecting connection reset after " << forwarded << " bytes\n";
+        }
+        else
+        {
+            peerError = true;
+            std::cout << "[conn " << id << "] socket error " << error << " after " << forwarded
+                      << " bytes; resetting both ends\n";
+        }
+        for (SOCKET s : {client, target})
+        {
+            linger lg;
+            lg.l_onoff = 1;
+            lg.l_linger = 0;
+            setsockopt(s, SOL_SOCKET, SO_LINGER, (const char *)&lg, sizeof(lg));
+        }
+        for (Pipe *p : {&up, &down})
+        {
+            std::lock_guard<std::mutex> lock(p->mutex);
+            p->aborted = true;
+            p->cv.notify_all();
+        }
+    }
+
+    bool finished() const { return aborting || stopping; }
+};
+
+// Wait up to POLL_MS for s to become readable (or writable); false on timeout
+bool waitSocket(SOCKET s, bool forWrite)
+{
+    fd_set set;
+    FD_ZERO(&set);
+    FD_SET(s, &set);
+    timeval timeout = {0, POLL_MS * 1000};
+    return select(static_cast<int>(s) + 1, forWrite ? NULL : &set, forWrite ? &set : NULL, NULL, &timeout) > 0;
+}
+
+// Read from src and queue each chunk with its release time
+void readSide(ProxyConnection &conn, SOCKET src, Pipe &pipe)
+{
+    std::vector<char> buf(PROXY_CHUNK);
+    Clock::time_point lastRelease = Clock::now();
+    while (!conn.finished())
+    {
+        if (!waitSocket(src, false))
+            continue;
+        int n = recv(src, buf.data(), PROXY_CHUNK, 0);
+        if (n == SOCKET_ERROR)
+        {
+            int err = WSAGetLastError();
+            if (err == WSAEWOULDBLOCK)
+                continue;
+            conn.abortBoth(false, err);
+            return;
+        }
+        Pipe::Packet packet;
+        if (n > 0)
+        {
+            packet.data.assign(buf.begin(), buf.begin() + n);
+            long long delayMs = config.latencyMs;
+            if (config.jitterMs > 0)
+                delayMs += static_cast<long long>(uniform(pipe.delayRng) * config.jitterMs);
+            if (config.stallProb > 0 && uniform(pipe.delayRng) < config.stallProb)
+                delayMs += config.stallMs;
+            // TCP delivers in order, so a delayed packet holds back everything behind it
+            packet.release = std::max(Clock::now() + std::chrono::milliseconds(delayMs), lastRelease);
+            lastRelease = packet.release;
+        }
+        else
+            packet.release = std::max(Clock::now() + std::chrono::milliseconds(config.latencyMs), lastRelease);
+
+        std::unique_lock<std::mutex> lock(pipe.mutex);
+        pipe.cv.wait(lock, [&]
+                     { return pipe.queuedBytes < MAX_QUEUED_BYTES || pipe.aborted; });
+        if (pipe.aborted)
+            return;
+        pipe.queuedBytes += packet.data.size();
+        bool end = packet.data.empty();
+        pipe.queue.push_back(std::move(packet));
+        pipe.cv.notify_all();
+        if (end)
+            return;
+    }
+}
+
+// Deliver queued packets to dst once due, at no more than the configured bandwidth
+void writeSide(ProxyConnection &conn, SOCKET dst, Pipe &pipe)
+{
+    Clock::time_point linkFree = Clock::now();
+    while (true)
+    {
+        Pipe::Packet packet;
+        {
+            std::unique_lock<std::mutex> lock(pipe.mutex);
+            pipe.cv.wait(lock, [&]
+                         { return !pipe.queue.empty() || pipe.aborted; });
+            if (pipe.aborted)
+                return;
+            packet = std::move(pipe.queue.front());
+            pipe.queue.pop_front();
+        }
+
+        Clock::time_point sendAt = packet.release;
+        if (!packet.data.empty())
+        {
+            sendAt = std::max(packet.release, linkFree);
+            if (config.bandwidthKbps > 0)
+                linkFree = sendAt + std::chrono::microseconds(packet.data.size() * 8 * 1000 / config.bandwidthKbps);
+        }
+        {
+            // A reset from the other direction cuts the wait short
+            std::unique_lock<std::mutex> lock(pipe.mutex);
+            if (pipe.cv.wait_until(lock, sendAt, [&]
+                                   { return pipe.aborted; }))
+                return;
+        }
+
+        if (packet.data.empty())
+        {
+            shutdown(dst, SD_SEND); // pass the half-close through
+            return;
+        }
+
+        int len = static_cast<int>(packet.data.size());
+        for (int total = 0; total < len;)
+        {
+            int sent = send(dst, packet.data.data() + total, len - total, 0);
+            if (sent == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK)
+            {
+                // Peer's window is full: wait for room, giving up if the connection goes down
+                while (!waitSocket(dst, true))
+                    if (conn.aborting)
+                        return;
+                continue;
+            }
+            if (sent == SOCKET_ERROR || sent == 0)
+            {
+                conn.abortBoth(false, sent == 0 ? 0 : WSAGetLastError());
+                return;
+            }
+            total += sent;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(pipe.mutex);
+            pipe.queuedBytes -= len;
+            pipe.bytes += len;
+        }
+        pipe.cv.notify_all();
+
+        long long total = conn.forwarded += len;
+        if ((config.resetAfter > 0 && total >= config.resetAfter) ||
+            (config.resetProb > 0 && uniform(pipe.resetRng) < config.resetProb))
+        {
+            conn.abortBoth(true);
+            return;
+        }
+    }
+}
+
+// Proxy one accepted client to the target until both directions finish
+// (ordinal counts the connections accepted on this port, from 0)
+void handleConnection(SOCKET client, sockaddr_in target, unsigned ordinal)
+{
+    auto conn = std::make_shared<ProxyConnection>();
+    conn->id = ++connectionCounter;
+    conn->client = client;
+    conn->up.seed(config.seed, ntohs(target.sin_port), ordinal, 0);
+    conn->down.seed(config.seed, ntohs(target.sin_port), ordinal, 1);
+    conn->target = socket(AF_INET, SOCK_STREAM, 0);
+    if (conn->target == INVALID_SOCKET || connect(conn->target, (sockaddr *)&target, sizeof(target)) == SOCKET_ERROR)
+    {
+        std::cerr << "[conn " << conn->id << "] cannot reach target port " << ntohs(target.sin_port) << "\n";
+        closesocket(client);
+        if (conn->target != INVALID_SOCKET)
+            closesocket(conn->target);
+        finishedConnections++;
+        return;
+    }
+
+    BOOL noDelay = TRUE; // the proxy does its own pacing; don't let Nagle add to it
+    setsockopt(conn->client, IPPROTO_TCP, TCP_NODELAY, (const char *)&noDelay, sizeof(noDelay));
+    setsockopt(conn->target, IPPROTO_TCP, TCP_NODELAY, (const char *)&noDelay, sizeof(noDelay));
+    u_long nonBlocking = 1;
+    ioctlsocket(conn->client, FIONBIO, &nonBlocking);
+    ioctlsocket(conn->target, FIONBIO, &nonBlocking);
+
+    auto start = Clock::now();
+    std::thread upReader(readSide, std::ref(*conn), conn->client, std::ref(conn->up));
+    std::thread upWriter(writeSide, std::ref(*conn), conn->target, std::ref(conn->up));
+    std::thread downReader(readSide, std::ref(*conn), conn->target, std::ref(conn->down));
+    std::thread downWriter(writeSide, std::ref(*conn), conn->client, std::ref(conn->down));
+    upWriter.join();
+    downWriter.join();
+    // Writers are done: stop readers still polling a socket or waiting on the window
+    conn->stopping = true;
+    for (Pipe *p : {&conn->up, &conn->down})
+    {
+        std::lock_guard<std::mutex> lock(p->mutex);
+        p->aborted = true;
+        p->cv.notify_all();
+    }
+    upReader.join();
+    downReader.join();
+    // No thread uses the sockets any more; after abortBoth this close sends RST
+    closesocket(conn->client);
+    closesocket(conn->target);
+
+    // One machine-readable line per connection for benchmark scripts
+    long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+    std::cout << "STATS conn=" << conn->id << " target_port=" << ntohs(target.sin_port)
+              << " up_bytes=" << conn->up.bytes << " down_bytes=" << conn->down.bytes << " ms=" << ms
+              << " down_MBps=" << (ms > 0 ? conn->down.bytes / 1024.0 / 1024.0 / (ms / 1000.0) : 0)
+              << " reset=" << (conn->reset ? 1 : 0) << " peer_error=" << (conn->peerError ? 1 : 0) << std::endl;
+    finishedConnections++;
+}
+
+// Parse "--name=value" options; returns false on anything unknown
+bool parseOption(const std::string &arg)
+{
+    size_t eq = arg.find('=');
+    if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+        return false;
+    std::string name = arg.substr(2, eq - 2);
+    const char *value = arg.c_str() + eq + 1;
+    if (name == "latency")
+        config.latencyMs = atoi(value);
+    else if (name == "jitter")
+        config.jitterMs = atoi(value);
+    else if (name == "bandwidth")
+        config.bandwidthKbps = atoll(value);
+    else if (name == "stall-prob")
+        config.stallProb = atof(value);
+    else if (name == "stall-ms")
+        config.stallMs = atoi(value);
+    else if (name == "reset-after")
+        config.resetAfter = atoll(value);
+    else if (name == "reset-prob")
+        config.resetProb = atof(value);
+    else if (name == "seed")
+        config.seed = static_cast<unsigned>(strtoul(value, NULL, 10));
+    else if (name == "max-connections")
+        config.maxConnections = atoi(value);
+    else
+        return false;
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    // Usage: wanproxy.exe <listen_base_port> <target_ip> <target_base_port> [options]
+    // Proxies listen_base_port -> target_base_port and listen_base_port+1 -> target_base_port+1,
+    // so a listener pointed at the proxy reaches both sender ports through the emulated link.
+    // This is a split-TCP relay: each leg is its own loopback connection that the proxy's stack
+    // ACKs at once, and delay is added in user space. The endpoints' kernels therefore still see
+    // loopback RTT (SIO_TCP_INFO reports ~0 ms), and in-flight data is capped by MAX_QUEUED_BYTES
+    // per direction rather than by the endpoints' SO_SNDBUF/SO_RCVBUF. It emulates what the
+    // application sees (delay, jitter, rate, stalls, resets), not the kernel's view of the path.
+    if (argc < 4)
+    {
+        std::cout << "Usage: wanproxy.exe <listen_base_port> <target_ip> <target_base_port> [options]\n"
+                  << "  --latency=ms        one-way delay per direction\n"
+                  << "  --jitter=ms         extra random delay per packet (order is preserved)\n"
+                  << "  --bandwidth=kbps    per-direction rate cap\n"
+                  << "  --stall-prob=p      chance per packet of a head-of-line stall\n"
+                  << "  --stall-ms=ms       stall length (default 200)\n"
+                  << "  --reset-after=bytes reset each connection after this many bytes\n"
+                  << "  --reset-prob=p      chance per packet of a connection reset\n"
+                  << "  --seed=n            random seed for reproducible runs\n"
+                  << "  --max-connections=n exit after n connections finish\n";
+        return 1;
+    }
+
+    int listenBase = atoi(argv[1]);
+    if (listenBase <= 0)
+        listenBase = PORT_RECEIVE;
+    const char *targetIp = argv[2];
+    int targetBase = atoi(argv[3]);
+    for (int i = 4; i < argc; ++i)
+    {
+        if (!parseOption(argv[i]))
+        {
+            std::cerr << "Unknown option: " << argv[i] << "\n";
+            return 1;
+        }
+    }
+
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+    {
+        std::cout << "WSAStartup failed!\n";
+        return 1;
+    }
+
+    std::cout << "WAN proxy: " << listenBase << "/" << listenBase + 1 << " -> " << targetIp << ":"
+              << targetBase << "/" << targetBase + 1 << "\n"
+              << "  latency " << config.latencyMs << " ms, jitter " << config.jitterMs << " ms, bandwidth "
+              << (config.bandwidthKbps ? std::to_string(config.bandwidthKbps) + " kbps" : std::string("unlimited"))
+              << ", stall " << config.stallProb << " x " << config.stallMs << " ms, reset after "
+              << config.resetAfter << " bytes / p=" << config.resetProb << ", seed " << config.seed << "\n";
+
+    auto acceptOnPort = [&](int listenPort, int targetPort)
+    {
+        SOCKET fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = INADDR_ANY;
+        addr.sin_port = htons(listenPort);
+        if (fd == INVALID_SOCKET || bind(fd, (sockaddr *)&addr, sizeof(addr)) == SOCKET_ERROR ||
+            listen(fd, SOMAXCONN) == SOCKET_ERROR)
+        {
+            std::cerr << "Cannot listen on port " << listenPort << "\n";
+            exit(1);
+        }
+
+        sockaddr_in target;
+        memset(&target, 0, sizeof(target));
+        target.sin_family = AF_INET;
+        target.sin_addr.s_addr = inet_addr(targetIp);
+        target.sin_port = htons(targetPort);
+
+        unsigned ordinal = 0;
+        while (true)
+        {
+            sockaddr_in clientAddr;
+            int clientLen = sizeof(clientAddr);
+            SOCKET client = accept(fd, (sockaddr *)&clientAddr, &clientLen);
+            if (client == INVALID_SOCKET)
+                continue;
+            std::thread(handleConnection, client, target, ordinal++).detach();
+        }
+    };
+
+    std::thread(acceptOnPort, listenBase, targetBase).detach();
+    std::thread(acceptOnPort, listenBase + 1, targetBase + 1).detach();
+
+    // Run until killed, or until the requested number of connections has completed
+    while (config.maxConnections == 0 || finishedConnections < config.maxConnections)
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    WSACleanup();
+    return 0;
+}